@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2019 Karl Otness
+ *
+ * This file is part of tree-sitter.el.
+ *
+ * tree-sitter.el is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * tree-sitter.el is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tree-sitter.el. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "tree_sitter/api.h"
+#include "pool.h"
+
+/*
+ * Times the tree-sitter runtime with the system allocator and with the
+ * pools from src/pool.c, using the C grammar. FILE is parsed from scratch ITERATIONS times,
+ * then edited ITERATIONS times, reparsing with the old tree after each
+ * edit as the module does. The edits insert a space somewhere in the
+ * file and delete it again, so the text never drifts. Only the calls
+ * to the parser are timed. Run once per allocator, since tree-sitter
+ * must not have allocated anything when the allocator is set.
+ */
+
+const TSLanguage *tree_sitter_c(void);
+
+static double tsel_bench_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool tsel_bench_read(const char *path, char **text, uint32_t *length) {
+  FILE *file = fopen(path, "rb");
+  if(!file) {
+    return false;
+  }
+  size_t capacity = 64 * 1024, size = 0;
+  char *buffer = malloc(capacity);
+  while(buffer) {
+    size += fread(buffer + size, 1, capacity - size, file);
+    if(size < capacity) {
+      break;
+    }
+    capacity *= 2;
+    char *grown = realloc(buffer, capacity);
+    if(!grown) {
+      free(buffer);
+    }
+    buffer = grown;
+  }
+  bool ok = buffer && !ferror(file) && size > 0 && size < UINT32_MAX;
+  fclose(file);
+  if(!ok) {
+    free(buffer);
+    return false;
+  }
+  *text = buffer;
+  *length = size;
+  return true;
+}
+
+static TSPoint tsel_bench_point(const char *text, uint32_t byte) {
+  TSPoint point = { 0, 0 };
+  for(uint32_t i = 0; i < byte; i++) {
+    if(text[i] == '\n') {
+      point.row++;
+      point.column = 0;
+    }
+    else {
+      point.column++;
+    }
+  }
+  return point;
+}
+
+static double tsel_bench_parse(TSParser *parser, const char *text, uint32_t length,
+                               long iterations) {
+  double seconds = 0;
+  for(long i = 0; i < iterations; i++) {
+    double start = tsel_bench_now();
+    TSTree *tree = ts_parser_parse_string(parser, NULL, text, length);
+    seconds += tsel_bench_now() - start;
+    if(!tree) {
+      return -1;
+    }
+    ts_tree_delete(tree);
+  }
+  return seconds;
+}
+
+static double tsel_bench_reparse(TSParser *parser, const char *text, uint32_t length,
+                                 long iterations) {
+  char *edited = malloc(length + 1);
+  if(!edited) {
+    return -1;
+  }
+  TSTree *tree = ts_parser_parse_string(parser, NULL, text, length);
+  double seconds = 0;
+  uint32_t position = 0;
+  for(long i = 0; i < iterations && tree; i++) {
+    // Even edits insert a space at a spread out position, odd edits
+    // delete it again
+    bool insert = i % 2 == 0;
+    if(insert) {
+      position = (uint32_t) ((uint64_t) (i / 2 + 1) * 7919 % length);
+      memcpy(edited, text, position);
+      edited[position] = ' ';
+      memcpy(edited + position + 1, text + position, length - position);
+    }
+    TSPoint before = tsel_bench_point(text, position), after = before;
+    after.column++;
+    TSInputEdit edit;
+    edit.start_byte = position;
+    edit.old_end_byte = insert ? position : position + 1;
+    edit.new_end_byte = insert ? position + 1 : position;
+    edit.start_point = before;
+    edit.old_end_point = insert ? before : after;
+    edit.new_end_point = insert ? after : before;
+    ts_tree_edit(tree, &edit);
+    double start = tsel_bench_now();
+    TSTree *new_tree = ts_parser_parse_string(parser, tree, insert ? edited : text,
+                                              insert ? length + 1 : length);
+    seconds += tsel_bench_now() - start;
+    ts_tree_delete(tree);
+    tree = new_tree;
+  }
+  free(edited);
+  if(!tree) {
+    return -1;
+  }
+  ts_tree_delete(tree);
+  return seconds;
+}
+
+static void tsel_bench_report(const char *allocator, const char *workload,
+                              long iterations, double seconds) {
+  printf("%s %s: %ld runs, %.6f s, %.3f ms each\n", allocator, workload,
+         iterations, seconds, seconds * 1000 / iterations);
+}
+
+int main(int argc, char **argv) {
+  if(argc < 3 || argc > 4) {
+    fprintf(stderr, "Usage: %s ALLOCATOR FILE [ITERATIONS]\n"
+            "ALLOCATOR is system or pool, and FILE a C source file.\n", argv[0]);
+    return 2;
+  }
+  const char *allocator = argv[1], *path = argv[2];
+  bool pool = strcmp(allocator, "pool") == 0;
+  if(!pool && strcmp(allocator, "system") != 0) {
+    fprintf(stderr, "Unknown allocator %s.\n", allocator);
+    return 2;
+  }
+  long iterations = argc > 3 ? strtol(argv[3], NULL, 10) : 20;
+  if(iterations <= 0) {
+    fprintf(stderr, "ITERATIONS must be a positive number.\n");
+    return 2;
+  }
+  char *text;
+  uint32_t length;
+  if(!tsel_bench_read(path, &text, &length)) {
+    fprintf(stderr, "Failed to read %s.\n", path);
+    return 1;
+  }
+  if(pool) {
+    ts_set_allocator(&tsel_pool_malloc, &tsel_pool_calloc, &tsel_pool_realloc, &tsel_pool_free);
+  }
+  TSParser *parser = ts_parser_new();
+  if(!parser || !ts_parser_set_language(parser, tree_sitter_c())) {
+    fprintf(stderr, "Failed to set up the parser.\n");
+    return 1;
+  }
+  double parse = tsel_bench_parse(parser, text, length, iterations);
+  double reparse = parse < 0 ? -1 : tsel_bench_reparse(parser, text, length, iterations);
+  ts_parser_delete(parser);
+  free(text);
+  if(reparse < 0) {
+    fprintf(stderr, "Parsing failed.\n");
+    return 1;
+  }
+  tsel_bench_report(allocator, "parse", iterations, parse);
+  tsel_bench_report(allocator, "reparse", iterations, reparse);
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF, &usage) == 0) {
+    printf("%s max rss: %ld KiB\n", allocator, usage.ru_maxrss);
+  }
+  if(pool) {
+    printf("%s retained: %zu KiB\n", allocator, tsel_pool_retained_bytes() / 1024);
+  }
+  return 0;
+}
@@ -29,6 +29,33 @@
 Users should not call this function."
   (record 'tree-sitter-language ptr))
 
+(defun tree-sitter-language-info--create (symbol-names symbol-types symbol-visible field-names)
+  "Create a new tree-sitter-language-info record.
+Users should not call this function."
+  (record 'tree-sitter-language-info symbol-names symbol-types symbol-visible field-names))
+
+(defun tree-sitter-language-info-symbol-names (info)
+  "Return the vector of symbol names in a tree-sitter-language-info, INFO.
+The vector is indexed by symbol code."
+  (aref info 1))
+
+(defun tree-sitter-language-info-symbol-types (info)
+  "Return the vector of symbol types in a tree-sitter-language-info, INFO.
+The vector is indexed by symbol code and holds the values returned by
+`tree-sitter-language-symbol-type'."
+  (aref info 2))
+
+(defun tree-sitter-language-info-symbol-visible (info)
+  "Return the vector of symbol visibility in a tree-sitter-language-info, INFO.
+The vector is indexed by symbol code and holds t for symbols which
+appear in trees and nil for auxiliary symbols."
+  (aref info 3))
+
+(defun tree-sitter-language-info-field-names (info)
+  "Return the vector of field names in a tree-sitter-language-info, INFO.
+The vector is indexed by field code. Slot 0 is unused and holds nil."
+  (aref info 4))
+
 (defun tree-sitter-query--create (ptr)
   "Create a new tree-sitter-query record.
 Users should not call this function."
@@ -39,6 +66,11 @@ Users should not call this function."
 Users should not call this function."
   (record 'tree-sitter-query-cursor ptr))
 
+(defun tree-sitter-query-result--create (ptr)
+  "Create a new tree-sitter-query-result record.
+Users should not call this function."
+  (record 'tree-sitter-query-result ptr))
+
 (defun tree-sitter-symbol--create (code)
   "Create a new tree-sitter-symbol record.
 Users should not call this function."
@@ -59,6 +91,56 @@ Users should not call this function."
 Users should not call this function."
   (record 'tree-sitter-tree ptr))
 
+(defun tree-sitter-tree-stats--create (node-count named-count max-depth average-depth
+                                                  histogram error-count missing-count leaf-bytes)
+  "Create a new tree-sitter-tree-stats record.
+Users should not call this function."
+  (record 'tree-sitter-tree-stats node-count named-count max-depth average-depth
+          histogram error-count missing-count leaf-bytes))
+
+(defun tree-sitter-tree-stats-node-count (stats)
+  "Return the number of nodes counted in tree-sitter-tree-stats STATS."
+  (aref stats 1))
+
+(defun tree-sitter-tree-stats-named-count (stats)
+  "Return the number of named nodes counted in tree-sitter-tree-stats STATS."
+  (aref stats 2))
+
+(defun tree-sitter-tree-stats-max-depth (stats)
+  "Return the maximum node depth in tree-sitter-tree-stats STATS.
+The root node has depth 0."
+  (aref stats 3))
+
+(defun tree-sitter-tree-stats-average-depth (stats)
+  "Return the average node depth in tree-sitter-tree-stats STATS as a float."
+  (aref stats 4))
+
+(defun tree-sitter-tree-stats-histogram (stats)
+  "Return the node type histogram in tree-sitter-tree-stats STATS.
+The vector is indexed by symbol code and holds the number of nodes
+with each symbol. ERROR nodes are counted separately, see
+`tree-sitter-tree-stats-error-count'."
+  (aref stats 5))
+
+(defun tree-sitter-tree-stats-error-count (stats)
+  "Return the number of ERROR nodes in tree-sitter-tree-stats STATS."
+  (aref stats 6))
+
+(defun tree-sitter-tree-stats-missing-count (stats)
+  "Return the number of MISSING nodes in tree-sitter-tree-stats STATS."
+  (aref stats 7))
+
+(defun tree-sitter-tree-stats-leaf-bytes (stats)
+  "Return the bytes covered by leaf nodes in tree-sitter-tree-stats STATS.
+This is the text inside tokens. Whitespace and other text skipped
+between tokens is not included."
+  (aref stats 8))
+
+(defun tree-sitter-tree-cursor--create (ptr)
+  "Create a new tree-sitter-tree-cursor record.
+Users should not call this function."
+  (record 'tree-sitter-tree-cursor ptr))
+
 (defun tree-sitter-node--create (ptr)
   "Create a new tree-sitter-tree record.
 Users should not call this function."
@@ -117,6 +199,35 @@ Users should not call this function."
              (end (tree-sitter--coerce-byte buf (+ byte-pos read-len))))
         (buffer-substring-no-properties start end)))))
 
+(defun tree-sitter--node-text (buf bytes no-properties max-length)
+  "Return a vector of the text in BUF between pairs of bytes in BYTES.
+BYTES is a vector holding a start and end byte for each string. If
+NO-PROPERTIES is non-nil the strings have no text properties. If
+MAX-LENGTH is non-nil no string is longer than that many characters.
+BUF defaults to the current buffer. Users should not call this function."
+  (with-current-buffer (or buf (current-buffer))
+    (save-restriction
+      (widen)
+      (let* ((count (/ (length bytes) 2))
+             (result (make-vector count nil)))
+        (dotimes (i count)
+          (let ((start (or (byte-to-position (aref bytes (* 2 i))) (point-max)))
+                (end (or (byte-to-position (aref bytes (1+ (* 2 i)))) (point-max))))
+            (when (and max-length (> (- end start) max-length))
+              (setq end (+ start max-length)))
+            (aset result i (if no-properties
+                               (buffer-substring-no-properties start end)
+                             (buffer-substring start end)))))
+        result))))
+
+(defun tree-sitter--buffer-text (buf)
+  "Return the whole text of BUF, ignoring narrowing, without properties.
+BUF defaults to the current buffer. Users should not call this function."
+  (with-current-buffer (or buf (current-buffer))
+    (save-restriction
+      (widen)
+      (buffer-substring-no-properties (point-min) (point-max)))))
+
 (defun tree-sitter-range--create (start-point end-point start-byte end-byte)
   "Create a new tree-sitter-range record.
 Users should not call this function."
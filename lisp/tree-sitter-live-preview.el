@@ -48,11 +48,7 @@
 
 (defun tree-sitter-live-preview--format (node)
   (let* ((name (tree-sitter-node-type node))
-         (start-byte (tree-sitter-node-start-byte node))
-         (end-byte (tree-sitter-node-end-byte node))
-         (start (byte-to-position start-byte))
-         (end (byte-to-position end-byte))
-         (text (tree-sitter-live-preview--shorten (buffer-substring start end))))
+         (text (tree-sitter-live-preview--shorten (tree-sitter-node-text node))))
     (let ((print-escape-newlines t))
       (cons (prin1-to-string name) (format "[%s]" text)))))
 
@@ -66,8 +62,7 @@
       (push-mark end t t))))
 
 (defun tree-sitter-live-preview--node (node parent-markers)
-  (let* ((name (tree-sitter-node-type node))
-         (next-sibling (tree-sitter-node-next-sibling node))
+  (let* ((next-sibling (tree-sitter-node-next-sibling node))
          (next-child (tree-sitter-node-child node 0))
          (prefix (mapconcat 'identity
                             (nreverse (cons (cond ((not parent-markers) "")
@@ -147,6 +147,15 @@ LANGUAGE must be a tree-sitter-language record."
 
 
 ;; Other functions
+(defun tree-sitter-live-node-at-point (&optional type)
+  "Return the smallest node of `tree-sitter-live-tree' at point.
+TYPE is as for `tree-sitter-tree-node-at'. Lookups near the
+previous one reuse its path, so calling this on every command is
+cheap. Returns nil if the buffer has no tree."
+  (when tree-sitter-live-tree
+    (tree-sitter-tree-node-at tree-sitter-live-tree
+                              (position-bytes (point)) type)))
+
 (defun tree-sitter-live-mode-turn-on ()
   "Maybe enable `tree-sitter-live-mode' for a buffer.
 Enable the mode if a language is defined chosen based on
@@ -34,13 +34,12 @@
 Returns a list of fields and their names for tree-sitter-language
 LANG. The list contains (NAME . FIELD) pairs where NAME is a
 string and FIELD is the tree-sitter-field record."
-  (let ((fields nil)
-        (count (tree-sitter-language-field-count lang)))
-    (dotimes (i count)
-      (let* ((id (1+ i))
-             (field (tree-sitter-field--create id))
-             (name (tree-sitter-language-field-name lang field)))
-        (push (cons name field) fields)))
+  (let* ((fields nil)
+         (names (tree-sitter-language-info-field-names
+                 (tree-sitter-language-info lang))))
+    (dotimes (i (1- (length names)))
+      (let ((id (1+ i)))
+        (push (cons (aref names id) (tree-sitter-field--create id)) fields)))
     (nreverse fields)))
 
 (defun tree-sitter-language-symbols (lang &optional type)
@@ -54,16 +53,89 @@ The optional argument TYPE allows filtering the list of symbols.
 When unspecified or nil all symbols will be included. When TYPE
 is another symbol only those symbols with a matching value under
 `tree-sitter-language-symbol-type' will be included."
-  (let ((symbols nil)
-        (count (tree-sitter-language-symbol-count lang)))
-    (dotimes (i count)
-      (let* ((id i)
-             (symbol (tree-sitter-symbol--create id))
-             (name (tree-sitter-language-symbol-name lang symbol)))
-        (when (or (not type) (eq type
-                                 (tree-sitter-language-symbol-type lang symbol)))
-          (push (cons name symbol) symbols))))
+  (let* ((symbols nil)
+         (info (tree-sitter-language-info lang))
+         (names (tree-sitter-language-info-symbol-names info))
+         (types (tree-sitter-language-info-symbol-types info)))
+    (dotimes (id (length names))
+      (when (or (not type) (eq type (aref types id)))
+        (push (cons (aref names id) (tree-sitter-symbol--create id)) symbols)))
     (nreverse symbols)))
 
+;; Node lookup
+
+(defun tree-sitter-node-descendants-for-positions (node positions &optional type)
+  "Return a vector of the descendants of NODE at each of POSITIONS.
+POSITIONS is a sequence of character positions in the current
+buffer, ideally sorted. They are converted to byte positions and
+looked up with `tree-sitter-node-descendants-for-bytes', which
+see for TYPE."
+  (tree-sitter-node-descendants-for-bytes
+   node (vconcat (mapcar #'position-bytes positions)) type))
+
+;; Tree export
+
+(defconst tree-sitter-tree-export--arrays
+  '((start-byte . 4) (end-byte . 4) (start-row . 4) (start-column . 4)
+    (parent . 4) (symbol . 2) (field . 2) (flags . 1))
+  "Arrays of a tree export in file order with their element sizes.")
+
+(defconst tree-sitter-tree-export-flags
+  '((named . 1) (extra . 2) (error . 4) (missing . 8) (has-error . 16))
+  "Bits of the flags array of a tree export.")
+
+(defun tree-sitter-tree-export (tree &optional file)
+  "Export every node in TREE in a packed binary form.
+When FILE is non-nil write the export to FILE and return FILE,
+otherwise return the export as a unibyte string.
+
+The export starts with a 32 byte header: the magic string
+\"TSELTREE\", then little-endian 32 bit integers holding the format
+version, the node count and the language's symbol count. Nodes
+follow in preorder as a struct of arrays, in the order given by
+`tree-sitter-tree-export--arrays', each array padded to a
+multiple of 8 bytes. Byte offsets, rows and columns are
+zero-based. The parent index of the root is #xFFFFFFFF. Read
+values with `tree-sitter-tree-export-ref'."
+  (if file
+      (progn (tree-sitter-tree-export-file tree (expand-file-name file))
+             file)
+    (let ((temp (make-temp-file "tree-sitter-export")))
+      (unwind-protect
+          (progn
+            (tree-sitter-tree-export-file tree temp)
+            (with-temp-buffer
+              (set-buffer-multibyte nil)
+              (insert-file-contents-literally temp)
+              (buffer-string)))
+        (delete-file temp)))))
+
+(defun tree-sitter-tree-export--uint (data offset size)
+  "Read a little-endian unsigned integer of SIZE bytes at OFFSET in DATA."
+  (let ((value 0))
+    (dotimes (i size)
+      (setq value (logior value (ash (aref data (+ offset i)) (* 8 i)))))
+    value))
+
+(defun tree-sitter-tree-export-count (data)
+  "Return the number of nodes in the tree export DATA."
+  (tree-sitter-tree-export--uint data 12 4))
+
+(defun tree-sitter-tree-export-ref (data array index)
+  "Return element INDEX of ARRAY in the tree export DATA.
+ARRAY is one of the keys of `tree-sitter-tree-export--arrays',
+such as 'start-byte, 'parent or 'flags."
+  (let ((count (tree-sitter-tree-export-count data))
+        (offset 32)
+        (found nil))
+    (dolist (entry tree-sitter-tree-export--arrays)
+      (unless found
+        (if (eq (car entry) array)
+            (setq found (cdr entry))
+          (setq offset (+ offset (* 8 (/ (+ (* count (cdr entry)) 7) 8)))))))
+    (unless found
+      (error "Unknown tree export array %s" array))
+    (tree-sitter-tree-export--uint data (+ offset (* index found)) found)))
+
 (provide 'tree-sitter)
 ;;; tree-sitter.el ends here
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2019 Karl Otness
+ *
+ * This file is part of tree-sitter.el.
+ *
+ * tree-sitter.el is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * tree-sitter.el is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tree-sitter.el. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include "tree_sitter/api.h"
+#include "alloc.h"
+#include "common.h"
+#include "pool.h"
+
+void tsel_ts_free(void *ptr) {
+#ifdef TSEL_POOL_ALLOCATOR
+  tsel_pool_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+static const char *tsel_allocator_doc = "Return the allocator used by the tree-sitter runtime.\n"
+  "This is the symbol 'pool if the module was built with the pooled\n"
+  "allocator and 'system otherwise.\n"
+  "\n"
+  "(fn)";
+static emacs_value tsel_allocator(emacs_env *env,
+                                  __attribute__((unused)) ptrdiff_t nargs,
+                                  __attribute__((unused)) emacs_value *args,
+                                  __attribute__((unused)) void *data) {
+#ifdef TSEL_POOL_ALLOCATOR
+  return env->intern(env, "pool");
+#else
+  return env->intern(env, "system");
+#endif
+}
+
+bool tsel_alloc_init(emacs_env *env) {
+#ifdef TSEL_POOL_ALLOCATOR
+  // Must run before tree-sitter allocates anything
+  ts_set_allocator(&tsel_pool_malloc, &tsel_pool_calloc, &tsel_pool_realloc, &tsel_pool_free);
+#endif
+  return tsel_define_function(env, "tree-sitter-allocator",
+                              &tsel_allocator, 0, 0,
+                              tsel_allocator_doc, NULL);
+}
@@ -17,8 +17,10 @@
  * along with tree-sitter.el. If not, see
  * <https://www.gnu.org/licenses/>.
  */
+#define _POSIX_C_SOURCE 200809L
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "common.h"
 
 emacs_value tsel_Qnil;
@@ -30,6 +32,13 @@ bool tsel_common_init(emacs_env *env) {
   return !tsel_pending_nonlocal_exit(env);
 }
 
+double tsel_now(void) {
+  // Seconds on a monotonic clock, for timing work
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 bool tsel_pending_nonlocal_exit(emacs_env *env) {
   return env->non_local_exit_check(env) != emacs_funcall_exit_return;
 }
@@ -43,6 +52,13 @@ void tsel_signal_wrong_type(emacs_env *env, char *type_pred_name, emacs_value va
   env->non_local_exit_signal(env, Qwrong_type_arg, err_info);
 }
 
+void tsel_signal_args_out_of_range(emacs_env *env, emacs_value val_provided) {
+  emacs_value Qlist = env->intern(env, "list");
+  emacs_value Qargs_out_of_range = env->intern(env, "args-out-of-range");
+  emacs_value err_info = env->funcall(env, Qlist, 1, &val_provided);
+  env->non_local_exit_signal(env, Qargs_out_of_range, err_info);
+}
+
 bool tsel_define_function(emacs_env *env, char *function_name, emacs_function *func,
                           ptrdiff_t min_arg_count, ptrdiff_t max_arg_count, const char *doc,
                           void *data) {
@@ -113,6 +129,35 @@ bool tsel_string_p(emacs_env *env, emacs_value obj) {
   return true;
 }
 
+bool tsel_copy_text(emacs_env *env, emacs_value obj, char **text, size_t *length) {
+  // OBJ is a string, or a buffer whose whole text is taken, nil meaning
+  // the current buffer. The copy is NUL terminated, but the text may
+  // hold NUL bytes too, so LENGTH comes from Emacs.
+  if(!tsel_string_p(env, obj)) {
+    emacs_value Qts_buffer_text = env->intern(env, "tree-sitter--buffer-text");
+    obj = env->funcall(env, Qts_buffer_text, 1, &obj);
+    if(tsel_pending_nonlocal_exit(env)) {
+      return false;
+    }
+  }
+  ptrdiff_t size = 0;
+  if(!env->copy_string_contents(env, obj, NULL, &size)) {
+    return false;
+  }
+  char *buf = malloc(size);
+  if(!buf) {
+    tsel_signal_error(env, "Allocation failed.");
+    return false;
+  }
+  if(!env->copy_string_contents(env, obj, buf, &size)) {
+    free(buf);
+    return false;
+  }
+  *text = buf;
+  *length = size - 1;
+  return true;
+}
+
 bool tsel_extract_string(emacs_env *env, emacs_value obj, char **res) {
   if(!tsel_string_p(env, obj)) {
     tsel_signal_wrong_type(env, "stringp", obj);
@@ -143,6 +188,19 @@ void tsel_signal_error(emacs_env *env, char *message) {
   env->non_local_exit_signal(env, Qerror, payload);
 }
 
+emacs_value tsel_make_vector(emacs_env *env, ptrdiff_t length, emacs_value init) {
+  emacs_value Qmake_vector = env->intern(env, "make-vector");
+  emacs_value args[2] = { env->make_integer(env, length), init };
+  return env->funcall(env, Qmake_vector, 2, args);
+}
+
+emacs_value tsel_intern_string(emacs_env *env, const char *name, size_t length) {
+  // Go through a Lisp string since env->intern only accepts ASCII names
+  emacs_value Qintern = env->intern(env, "intern");
+  emacs_value str = env->make_string(env, name, length);
+  return env->funcall(env, Qintern, 1, &str);
+}
+
 bool tsel_integer_p(emacs_env *env, emacs_value obj) {
   emacs_value Qstringp = env->intern(env, "integerp");
   emacs_value args[1] = { obj };
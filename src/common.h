@@ -39,7 +39,9 @@ typedef void (emacs_finalizer) (void *obj);
 
 bool tsel_common_init(emacs_env *env);
 bool tsel_pending_nonlocal_exit(emacs_env *env);
+double tsel_now(void);
 void tsel_signal_wrong_type(emacs_env *env, char *type_pred_name, emacs_value val_provided);
+void tsel_signal_args_out_of_range(emacs_env *env, emacs_value val_provided);
 bool tsel_define_function(emacs_env *env, char *function_name, emacs_function *func,
                           ptrdiff_t min_arg_count, ptrdiff_t max_arg_count, const char *doc,
                           void *data);
@@ -47,7 +49,10 @@ bool tsel_record_get_field(emacs_env *env, emacs_value obj, uint8_t field, emacs
 bool tsel_check_record_type(emacs_env *env, char *record_type, emacs_value obj, int num_fields);
 bool tsel_string_p(emacs_env *env, emacs_value obj);
 bool tsel_extract_string(emacs_env *env, emacs_value obj, char **res);
+bool tsel_copy_text(emacs_env *env, emacs_value obj, char **text, size_t *length);
 void tsel_signal_error(emacs_env *env, char *message);
+emacs_value tsel_make_vector(emacs_env *env, ptrdiff_t length, emacs_value init);
+emacs_value tsel_intern_string(emacs_env *env, const char *name, size_t length);
 bool tsel_integer_p(emacs_env *env, emacs_value obj);
 bool tsel_extract_integer(emacs_env *env, emacs_value obj, intmax_t *res);
 bool tsel_extract_buffer(emacs_env *env, emacs_value obj, emacs_value *res);
@@ -19,6 +19,7 @@
  */
 #include <emacs-module.h>
 #include "common.h"
+#include "alloc.h"
 #include "language.h"
 #include "symbol.h"
 #include "parser.h"
@@ -29,6 +30,9 @@
 #include "field.h"
 #include "query.h"
 #include "qcursor.h"
+#include "qresult.h"
+#include "parallel.h"
+#include "tcursor.h"
 // Required symbol for Emacs loading
 int plugin_is_GPL_compatible;
 
@@ -44,12 +48,14 @@ int emacs_module_init(struct emacs_runtime *ert) {
     return 3;
   }
   // Perform initialization
-  if(!tsel_common_init(env) || !tsel_language_init(env) ||
-     !tsel_symbol_init(env) || !tsel_parser_init(env) ||
-     !tsel_tree_init(env) || !tsel_node_init(env) ||
-     !tsel_point_init(env) || !tsel_range_init(env) ||
-     !tsel_field_init(env) || !tsel_query_init(env) ||
-     !tsel_qcursor_init(env)){
+  if(!tsel_common_init(env) || !tsel_alloc_init(env) ||
+     !tsel_language_init(env) || !tsel_symbol_init(env) ||
+     !tsel_parser_init(env) || !tsel_tree_init(env) ||
+     !tsel_node_init(env) || !tsel_point_init(env) ||
+     !tsel_range_init(env) || !tsel_field_init(env) ||
+     !tsel_query_init(env) || !tsel_qcursor_init(env) ||
+     !tsel_qresult_init(env) || !tsel_parallel_init(env) ||
+     !tsel_tcursor_init(env)){
     return 1;
   }
   // Provide the module
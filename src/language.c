@@ -24,6 +24,8 @@
 #include "field.h"
 #include "common.h"
 
+static TSElLanguageCache *tsel_language_caches = NULL;
+
 static const char *tsel_language_symbol_count_doc = "Count the number of symbols in LANG.\n"
   "LANG is a `tree-sitter-language-p' object.\n"
   "\n"
@@ -81,6 +83,19 @@ static emacs_value tsel_language_symbol_for_name(emacs_env *env,
   return res;
 }
 
+static emacs_value tsel_symbol_type_emacs(emacs_env *env, TSSymbolType type) {
+  if(type == TSSymbolTypeRegular) {
+    return env->intern(env, "regular");
+  }
+  else if(type == TSSymbolTypeAnonymous) {
+    return env->intern(env, "anonymous");
+  }
+  else if(type == TSSymbolTypeAuxiliary) {
+    return env->intern(env, "auxiliary");
+  }
+  return tsel_Qnil;
+}
+
 static const char *tsel_language_symbol_type_doc = "Return the type of SYMBOL.\n"
   "Type type of SYMBOL is determined under the tree-sitter-language LANG.\n"
   "This will be one of 'regular, 'anonymous, or 'auxiliary. The value nil may\n"
@@ -96,17 +111,7 @@ static emacs_value tsel_language_symbol_type(emacs_env *env,
   TSSymbol symbol;
   TSEL_SUBR_EXTRACT(language, env, args[0], &lang);
   TSEL_SUBR_EXTRACT(tssymbol, env, args[1], &symbol);
-  TSSymbolType type = ts_language_symbol_type(lang->ptr, symbol);
-  if(type == TSSymbolTypeRegular) {
-    return env->intern(env, "regular");
-  }
-  else if(type == TSSymbolTypeAnonymous) {
-    return env->intern(env, "anonymous");
-  }
-  else if(type == TSSymbolTypeAuxiliary) {
-    return env->intern(env, "auxiliary");
-  }
-  return tsel_Qnil;
+  return tsel_symbol_type_emacs(env, ts_language_symbol_type(lang->ptr, symbol));
 }
 
 static const char *tsel_language_field_count_doc = "Count the number of field types in LANG.\n"
@@ -173,6 +178,140 @@ static emacs_value tsel_language_version(emacs_env *env,
   return env->make_integer(env, ts_language_version(lang->ptr));
 }
 
+static emacs_value tsel_language_info_build(emacs_env *env, const TSLanguage *lang) {
+  uint32_t symbol_count = ts_language_symbol_count(lang);
+  uint32_t field_count = ts_language_field_count(lang);
+  emacs_value names = tsel_make_vector(env, symbol_count, tsel_Qnil);
+  emacs_value types = tsel_make_vector(env, symbol_count, tsel_Qnil);
+  emacs_value visible = tsel_make_vector(env, symbol_count, tsel_Qnil);
+  emacs_value fields = tsel_make_vector(env, field_count + 1, tsel_Qnil);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  for(uint32_t i = 0; i < symbol_count; i++) {
+    const char *name = ts_language_symbol_name(lang, i);
+    TSSymbolType type = ts_language_symbol_type(lang, i);
+    env->vec_set(env, names, i, env->make_string(env, name, strlen(name)));
+    env->vec_set(env, types, i, tsel_symbol_type_emacs(env, type));
+    env->vec_set(env, visible, i, type == TSSymbolTypeAuxiliary ? tsel_Qnil : tsel_Qt);
+    if(tsel_pending_nonlocal_exit(env)) {
+      return tsel_Qnil;
+    }
+  }
+  // Field ids start at 1, slot 0 stays nil
+  for(uint32_t i = 1; i <= field_count; i++) {
+    const char *name = ts_language_field_name_for_id(lang, i);
+    env->vec_set(env, fields, i, env->make_string(env, name, strlen(name)));
+    if(tsel_pending_nonlocal_exit(env)) {
+      return tsel_Qnil;
+    }
+  }
+  emacs_value Qinfo_create = env->intern(env, "tree-sitter-language-info--create");
+  emacs_value args[4] = { names, types, visible, fields };
+  return env->funcall(env, Qinfo_create, 4, args);
+}
+
+static const char *tsel_language_info_doc = "Return a tree-sitter-language-info record for LANG.\n"
+  "The record holds vectors of symbol names, symbol types and symbol\n"
+  "visibility indexed by symbol code, and a vector of field names indexed\n"
+  "by field code. See `tree-sitter-language-info-symbol-names' and the\n"
+  "related accessors. The record is built once per language and shared\n"
+  "between callers, so it must not be modified.\n"
+  "\n"
+  "(fn LANG)";
+static emacs_value tsel_language_info(emacs_env *env,
+                                      __attribute__((unused)) ptrdiff_t nargs,
+                                      emacs_value *args,
+                                      __attribute__((unused)) void *data) {
+  TSElLanguage *lang;
+  TSEL_SUBR_EXTRACT(language, env, args[0], &lang);
+  TSElLanguageCache *cache = tsel_language_cache(lang->ptr);
+  if(!cache) {
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  if(!cache->info) {
+    emacs_value info = tsel_language_info_build(env, lang->ptr);
+    if(tsel_pending_nonlocal_exit(env)) {
+      return tsel_Qnil;
+    }
+    cache->info = env->make_global_ref(env, info);
+  }
+  return cache->info;
+}
+
+static const char *tsel_language_set_category_doc = "Define the symbol category NAME in LANG.\n"
+  "NAME is a Lisp symbol and SYMBOLS is a list of tree-sitter-symbol records\n"
+  "which make up the category, replacing any previous definition. The\n"
+  "categories 'named and 'anonymous are predefined and cannot be changed.\n"
+  "Categories are stored as bitsets which native functions accepting a\n"
+  "category name test in constant time.\n"
+  "\n"
+  "(fn LANG NAME SYMBOLS)";
+static emacs_value tsel_language_set_category(emacs_env *env,
+                                              __attribute__((unused)) ptrdiff_t nargs,
+                                              emacs_value *args,
+                                              __attribute__((unused)) void *data) {
+  TSElLanguage *lang;
+  TSEL_SUBR_EXTRACT(language, env, args[0], &lang);
+  TSElLanguageCache *cache = tsel_language_cache(lang->ptr);
+  if(!cache) {
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  TSElSymbolSet *existing = tsel_language_category(env, cache, args[1]);
+  if(existing == &cache->named || existing == &cache->anonymous) {
+    tsel_signal_error(env, "Predefined categories cannot be changed.");
+    return tsel_Qnil;
+  }
+  TSElSymbolSet set;
+  if(!tsel_extract_symbol_set(env, args[2], cache->symbol_count, &set)) {
+    return tsel_Qnil;
+  }
+  if(existing) {
+    tsel_symbol_set_free(existing);
+    *existing = set;
+    return tsel_Qnil;
+  }
+  TSElSymbolCategory *cat = malloc(sizeof(TSElSymbolCategory));
+  if(!cat) {
+    tsel_symbol_set_free(&set);
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  cat->name = env->make_global_ref(env, args[1]);
+  cat->set = set;
+  cat->next = cache->categories;
+  cache->categories = cat;
+  return tsel_Qnil;
+}
+
+static const char *tsel_language_category_p_doc = "Return t if SYMBOL is in category NAME of LANG.\n"
+  "NAME is 'named, 'anonymous or a category defined with\n"
+  "`tree-sitter-language-set-category'. SYMBOL is a tree-sitter-symbol.\n"
+  "\n"
+  "(fn LANG NAME SYMBOL)";
+static emacs_value tsel_language_category_p(emacs_env *env,
+                                            __attribute__((unused)) ptrdiff_t nargs,
+                                            emacs_value *args,
+                                            __attribute__((unused)) void *data) {
+  TSElLanguage *lang;
+  TSSymbol symbol;
+  TSEL_SUBR_EXTRACT(language, env, args[0], &lang);
+  TSEL_SUBR_EXTRACT(tssymbol, env, args[2], &symbol);
+  TSElLanguageCache *cache = tsel_language_cache(lang->ptr);
+  if(!cache) {
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  TSElSymbolSet *set = tsel_language_category(env, cache, args[1]);
+  if(!set) {
+    tsel_signal_error(env, "Unknown symbol category.");
+    return tsel_Qnil;
+  }
+  return tsel_symbol_set_contains(set, symbol) ? tsel_Qt : tsel_Qnil;
+}
+
 static const char *tsel_language_p_wrapped_doc = "Return t if OBJECT is a tree-sitter-language.\n"
   "\n"
   "(fn OBJECT)";
@@ -214,6 +353,15 @@ bool tsel_language_init(emacs_env *env) {
   function_result &= tsel_define_function(env, "tree-sitter-language-field-for-name",
                                           &tsel_language_field_for_name, 2, 2,
                                           tsel_language_field_for_name_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-language-info",
+                                          &tsel_language_info, 1, 1,
+                                          tsel_language_info_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-language-set-category",
+                                          &tsel_language_set_category, 3, 3,
+                                          tsel_language_set_category_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-language-category-p",
+                                          &tsel_language_category_p, 3, 3,
+                                          tsel_language_category_p_doc, NULL);
   return function_result;
 }
 
@@ -261,6 +409,141 @@ bool tsel_extract_language(emacs_env *env, emacs_value obj, TSElLanguage **lang)
   return true;
 }
 
+TSElLanguageCache *tsel_language_cache(const TSLanguage *lang) {
+  // Only a handful of languages are ever loaded, a list is enough
+  for(TSElLanguageCache *cache = tsel_language_caches; cache; cache = cache->next) {
+    if(cache->ptr == lang) {
+      return cache;
+    }
+  }
+  TSElLanguageCache *cache = malloc(sizeof(TSElLanguageCache));
+  if(!cache) {
+    return NULL;
+  }
+  cache->ptr = lang;
+  cache->symbol_count = ts_language_symbol_count(lang);
+  cache->type_symbols = calloc(cache->symbol_count + 1, sizeof(emacs_value));
+  cache->field_count = ts_language_field_count(lang);
+  cache->field_symbols = calloc(cache->field_count + 1, sizeof(emacs_value));
+  cache->info = NULL;
+  cache->categories = NULL;
+  bool sets_ok = tsel_symbol_set_init(&cache->named, cache->symbol_count);
+  sets_ok &= tsel_symbol_set_init(&cache->anonymous, cache->symbol_count);
+  if(!cache->type_symbols || !cache->field_symbols || !sets_ok) {
+    free(cache->type_symbols);
+    free(cache->field_symbols);
+    tsel_symbol_set_free(&cache->named);
+    tsel_symbol_set_free(&cache->anonymous);
+    free(cache);
+    return NULL;
+  }
+  for(uint32_t i = 0; i < cache->symbol_count; i++) {
+    TSSymbolType type = ts_language_symbol_type(lang, i);
+    if(type == TSSymbolTypeRegular) {
+      tsel_symbol_set_add(&cache->named, i);
+    }
+    else if(type == TSSymbolTypeAnonymous) {
+      tsel_symbol_set_add(&cache->anonymous, i);
+    }
+  }
+  cache->next = tsel_language_caches;
+  tsel_language_caches = cache;
+  return cache;
+}
+
+emacs_value tsel_language_type_symbol(emacs_env *env, TSElLanguageCache *cache, TSSymbol symbol) {
+  if(symbol >= cache->symbol_count) {
+    return tsel_Qnil;
+  }
+  if(!cache->type_symbols[symbol]) {
+    // Interned symbols are never collected, so the global reference
+    // only pins what Emacs keeps anyway.
+    const char *name = ts_language_symbol_name(cache->ptr, symbol);
+    emacs_value sym = tsel_intern_string(env, name, strlen(name));
+    if(tsel_pending_nonlocal_exit(env)) {
+      return tsel_Qnil;
+    }
+    cache->type_symbols[symbol] = env->make_global_ref(env, sym);
+  }
+  return cache->type_symbols[symbol];
+}
+
+emacs_value tsel_language_field_symbol(emacs_env *env, TSElLanguageCache *cache, TSFieldId field) {
+  if(field == 0 || field > cache->field_count) {
+    return tsel_Qnil;
+  }
+  if(!cache->field_symbols[field]) {
+    const char *name = ts_language_field_name_for_id(cache->ptr, field);
+    emacs_value sym = tsel_intern_string(env, name, strlen(name));
+    if(tsel_pending_nonlocal_exit(env)) {
+      return tsel_Qnil;
+    }
+    cache->field_symbols[field] = env->make_global_ref(env, sym);
+  }
+  return cache->field_symbols[field];
+}
+
+bool tsel_language_extract_field(emacs_env *env, TSElLanguageCache *cache, emacs_value obj, TSFieldId *field) {
+  // Accept either a tree-sitter-field record or a field name symbol
+  if(tsel_field_p(env, obj)) {
+    return tsel_extract_tsfieldid(env, obj, field);
+  }
+  emacs_value Qsymbolp = env->intern(env, "symbolp");
+  if(!env->is_not_nil(env, env->funcall(env, Qsymbolp, 1, &obj)) ||
+     tsel_pending_nonlocal_exit(env)) {
+    tsel_signal_wrong_type(env, "tree-sitter-field-p", obj);
+    return false;
+  }
+  for(TSFieldId i = 1; i <= cache->field_count; i++) {
+    if(env->eq(env, obj, tsel_language_field_symbol(env, cache, i))) {
+      *field = i;
+      return true;
+    }
+  }
+  // Unknown names match no child
+  *field = 0;
+  return !tsel_pending_nonlocal_exit(env);
+}
+
+TSElSymbolSet *tsel_language_category(emacs_env *env, TSElLanguageCache *cache, emacs_value name) {
+  if(env->eq(env, name, env->intern(env, "named"))) {
+    return &cache->named;
+  }
+  if(env->eq(env, name, env->intern(env, "anonymous"))) {
+    return &cache->anonymous;
+  }
+  for(TSElSymbolCategory *cat = cache->categories; cat; cat = cat->next) {
+    if(env->eq(env, name, cat->name)) {
+      return &cat->set;
+    }
+  }
+  return NULL;
+}
+
+bool tsel_language_symbol_filter(emacs_env *env, TSElLanguageCache *cache, emacs_value obj,
+                                 TSElSymbolSet *storage, TSElSymbolSet **set) {
+  // OBJ is nil for no filter, a category name, or a list of symbols. A
+  // list is converted into STORAGE, which the caller must then free.
+  *set = NULL;
+  if(!env->is_not_nil(env, obj)) {
+    return true;
+  }
+  emacs_value Qconsp = env->intern(env, "consp");
+  if(env->is_not_nil(env, env->funcall(env, Qconsp, 1, &obj))) {
+    if(!tsel_extract_symbol_set(env, obj, cache->symbol_count, storage)) {
+      return false;
+    }
+    *set = storage;
+    return true;
+  }
+  *set = tsel_language_category(env, cache, obj);
+  if(!*set) {
+    tsel_signal_error(env, "Unknown symbol category.");
+    return false;
+  }
+  return !tsel_pending_nonlocal_exit(env);
+}
+
 emacs_value tsel_language_wrap(emacs_env *env, TSElLanguage *lang) {
   emacs_value Qts_language_create = env->intern(env, "tree-sitter-language--create");
   emacs_value user_ptr = env->make_user_ptr(env, NULL, lang);
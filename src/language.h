@@ -23,6 +23,7 @@
 #include <stdbool.h>
 #include <emacs-module.h>
 #include "tree_sitter/api.h"
+#include "symbol.h"
 
 typedef struct TSElLanguage {
   // Tag to check type, must be "TSLanguage" followed by null char.
@@ -30,9 +31,43 @@ typedef struct TSElLanguage {
   TSLanguage *ptr;
 } TSElLanguage;
 
+// A named set of symbols defined from Lisp with
+// `tree-sitter-language-set-category'.
+typedef struct TSElSymbolCategory {
+  emacs_value name;
+  TSElSymbolSet set;
+  struct TSElSymbolCategory *next;
+} TSElSymbolCategory;
+
+// Per-language data computed once by the module. TSElLanguage structs
+// are allocated by the grammar packages, so these live in a separate
+// table keyed by the TSLanguage pointer.
+typedef struct TSElLanguageCache {
+  const TSLanguage *ptr;
+  uint32_t symbol_count;
+  // Interned Lisp symbols for each symbol name, indexed by TSSymbol
+  emacs_value *type_symbols;
+  uint32_t field_count;
+  // Interned Lisp symbols for each field name, indexed by TSFieldId
+  emacs_value *field_symbols;
+  // Cached tree-sitter-language-info record, or NULL until requested
+  emacs_value info;
+  TSElSymbolSet named;
+  TSElSymbolSet anonymous;
+  TSElSymbolCategory *categories;
+  struct TSElLanguageCache *next;
+} TSElLanguageCache;
+
 bool tsel_language_init(emacs_env *env);
 bool tsel_language_p(emacs_env *env, emacs_value obj);
 bool tsel_extract_language(emacs_env *env, emacs_value obj, TSElLanguage **lang);
 emacs_value tsel_language_wrap(emacs_env *env, TSElLanguage *lang);
+TSElLanguageCache *tsel_language_cache(const TSLanguage *lang);
+emacs_value tsel_language_type_symbol(emacs_env *env, TSElLanguageCache *cache, TSSymbol symbol);
+emacs_value tsel_language_field_symbol(emacs_env *env, TSElLanguageCache *cache, TSFieldId field);
+bool tsel_language_extract_field(emacs_env *env, TSElLanguageCache *cache, emacs_value obj, TSFieldId *field);
+TSElSymbolSet *tsel_language_category(emacs_env *env, TSElLanguageCache *cache, emacs_value name);
+bool tsel_language_symbol_filter(emacs_env *env, TSElLanguageCache *cache, emacs_value obj,
+                                 TSElSymbolSet *storage, TSElSymbolSet **set);
 
 #endif //ifndef TSEL_LANGUAGE_H
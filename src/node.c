@@ -17,12 +17,17 @@
  * along with tree-sitter.el. If not, see
  * <https://www.gnu.org/licenses/>.
  */
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include "node.h"
 #include "common.h"
 #include "symbol.h"
 #include "point.h"
+#include "language.h"
+#include "field.h"
+
+static emacs_value Qts_node_text;
 
 static void tsel_node_fin(void *ptr) {
   TSElNode *node = ptr;
@@ -80,6 +85,21 @@ static emacs_value tsel_node_type(emacs_env *env,
   return str;
 }
 
+static const char *tsel_node_type_symbol_doc = "Return the type of node NODE as an interned symbol.\n"
+  "The symbol's name is the string returned by `tree-sitter-node-type'.\n"
+  "Symbols are cached for each language so the result may be compared\n"
+  "with `eq' and no string is allocated.\n"
+  "\n"
+  "(fn NODE)";
+static emacs_value tsel_node_type_symbol_wrapped(emacs_env *env,
+                                                 __attribute__((unused)) ptrdiff_t nargs,
+                                                 emacs_value *args,
+                                                 __attribute__((unused)) void *data) {
+  TSElNode *node;
+  TSEL_SUBR_EXTRACT(node, env, args[0], &node);
+  return tsel_node_type_symbol(env, node->node, node->tree);
+}
+
 static const char *tsel_node_start_byte_doc = "Return the starting byte of a tree-sitter node.\n"
   "\n"
   "(fn NODE)";
@@ -356,6 +376,63 @@ static emacs_value tsel_node_descendant_for_byte_range(emacs_env *env,
   return tsel_node_emacs_move(env, child, node->tree);
 }
 
+static const char *tsel_node_descendants_for_bytes_doc = "Return a vector of the descendants of NODE at each byte of BYTES.\n"
+  "BYTES is a vector of byte positions. Element I of the result is the node\n"
+  "`tree-sitter-node-descendant-for-byte-range' would return for a\n"
+  "zero-width range at element I of BYTES. If TYPE is the symbol 'named\n"
+  "only named nodes are returned.\n"
+  "The positions may come in any order and each result is the same as a\n"
+  "lookup of its own. When sorted, the descent for each position starts\n"
+  "from the result for the one before it, so the total work is close to\n"
+  "one walk over the range covered.\n"
+  "\n"
+  "(fn NODE BYTES &optional TYPE)";
+static emacs_value tsel_node_descendants_for_bytes(emacs_env *env,
+                                                   ptrdiff_t nargs,
+                                                   emacs_value *args,
+                                                   __attribute__((unused)) void *data) {
+  TSElNode *node;
+  TSEL_SUBR_EXTRACT(node, env, args[0], &node);
+  ptrdiff_t count = env->vec_size(env, args[1]);
+  bool named = nargs > 2 && tsel_named_nodes(env, args[2]);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  emacs_value result = tsel_make_vector(env, count, tsel_Qnil);
+  TSElNodePath path = {0};
+  if(tsel_pending_nonlocal_exit(env) || !tsel_node_path_push(&path, node->node)) {
+    tsel_node_path_free(&path);
+    return tsel_Qnil;
+  }
+  for(ptrdiff_t i = 0; i < count; i++) {
+    intmax_t byte;
+    if(!tsel_extract_integer(env, env->vec_get(env, args[1], i), &byte)) {
+      break;
+    }
+    if(!tsel_node_path_seek(&path, byte - 1)) {
+      tsel_signal_error(env, "Allocation failed.");
+      break;
+    }
+    uint32_t depth = path.depth;
+    if(named) {
+      // Same as ts_node_named_descendant_for_byte_range: the deepest
+      // named node on the path, or NODE itself
+      while(depth > 1 && !ts_node_is_named(path.nodes[depth - 1])) {
+        depth--;
+      }
+    }
+    env->vec_set(env, result, i, tsel_node_emacs_move(env, path.nodes[depth - 1], node->tree));
+    if(tsel_pending_nonlocal_exit(env)) {
+      break;
+    }
+  }
+  tsel_node_path_free(&path);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return result;
+}
+
 static const char *tsel_node_descendant_for_point_range_doc = "Return descendant of NODE for point range START to END.\n"
   "If TYPE is nil, t, or unspecified include all siblings. Otherwise, if\n"
   "TYPE is the symbol 'named include only named siblings.\n"
@@ -385,6 +462,503 @@ static emacs_value tsel_node_descendant_for_point_range(emacs_env *env,
   return tsel_node_emacs_move(env, child, node->tree);
 }
 
+static const char *tsel_node_child_by_field_doc = "Return the child of NODE for FIELD.\n"
+  "FIELD is either a tree-sitter-field record or a symbol naming a field of\n"
+  "the node's language, such as 'name or 'body. Field symbols are resolved\n"
+  "once per language. Returns nil if there is no such child.\n"
+  "\n"
+  "(fn NODE FIELD)";
+static emacs_value tsel_node_child_by_field(emacs_env *env,
+                                            __attribute__((unused)) ptrdiff_t nargs,
+                                            emacs_value *args,
+                                            __attribute__((unused)) void *data) {
+  TSElNode *node;
+  TSFieldId field;
+  TSEL_SUBR_EXTRACT(node, env, args[0], &node);
+  TSElLanguageCache *cache = tsel_node_language_cache(env, node);
+  if(!cache || !tsel_language_extract_field(env, cache, args[1], &field) || field == 0) {
+    return tsel_Qnil;
+  }
+  TSNode child = ts_node_child_by_field_id(node->node, field);
+  return tsel_node_emacs_move(env, child, node->tree);
+}
+
+static const char *tsel_node_children_by_field_doc = "Return a list of all children of NODE for FIELD.\n"
+  "FIELD is either a tree-sitter-field record or a field name symbol as for\n"
+  "`tree-sitter-node-child-by-field'. Children are listed in order.\n"
+  "\n"
+  "(fn NODE FIELD)";
+static emacs_value tsel_node_children_by_field(emacs_env *env,
+                                               __attribute__((unused)) ptrdiff_t nargs,
+                                               emacs_value *args,
+                                               __attribute__((unused)) void *data) {
+  TSElNode *node;
+  TSFieldId field;
+  TSEL_SUBR_EXTRACT(node, env, args[0], &node);
+  TSElLanguageCache *cache = tsel_node_language_cache(env, node);
+  if(!cache || !tsel_language_extract_field(env, cache, args[1], &field) || field == 0) {
+    return tsel_Qnil;
+  }
+  // Collect matching children, then build the list back to front
+  uint32_t count = 0;
+  uint32_t child_count = ts_node_child_count(node->node);
+  if(child_count == 0) {
+    return tsel_Qnil;
+  }
+  TSNode *children = malloc(sizeof(TSNode) * child_count);
+  if(!children) {
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  TSTreeCursor cursor = ts_tree_cursor_new(node->node);
+  if(ts_tree_cursor_goto_first_child(&cursor)) {
+    do {
+      if(ts_tree_cursor_current_field_id(&cursor) == field) {
+        children[count++] = ts_tree_cursor_current_node(&cursor);
+      }
+    } while(ts_tree_cursor_goto_next_sibling(&cursor));
+  }
+  ts_tree_cursor_delete(&cursor);
+  emacs_value Qcons = env->intern(env, "cons");
+  emacs_value list = tsel_Qnil;
+  for(uint32_t i = count; i > 0 && !tsel_pending_nonlocal_exit(env); i--) {
+    emacs_value cons_args[2] = { tsel_node_emacs_move(env, children[i - 1], node->tree), list };
+    list = env->funcall(env, Qcons, 2, cons_args);
+  }
+  free(children);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return list;
+}
+
+static emacs_value tsel_node_children_vector(emacs_env *env, TSElNode *node, bool named,
+                                             TSElLanguageCache *fields) {
+  uint32_t count = named ? ts_node_named_child_count(node->node) : ts_node_child_count(node->node);
+  emacs_value vec = tsel_make_vector(env, count, tsel_Qnil);
+  if(count == 0 || tsel_pending_nonlocal_exit(env)) {
+    return vec;
+  }
+  emacs_value Qcons = env->intern(env, "cons");
+  // One sibling walk, ts_node_child would rescan from the start each time
+  TSTreeCursor cursor = ts_tree_cursor_new(node->node);
+  bool more = ts_tree_cursor_goto_first_child(&cursor);
+  for(uint32_t i = 0; more && i < count; more = ts_tree_cursor_goto_next_sibling(&cursor)) {
+    TSNode child = ts_tree_cursor_current_node(&cursor);
+    if(named && !ts_node_is_named(child)) {
+      continue;
+    }
+    emacs_value elem = tsel_node_emacs_move(env, child, node->tree);
+    if(fields) {
+      TSFieldId field = ts_tree_cursor_current_field_id(&cursor);
+      emacs_value cons_args[2] = { elem, tsel_language_field_symbol(env, fields, field) };
+      elem = env->funcall(env, Qcons, 2, cons_args);
+    }
+    if(tsel_pending_nonlocal_exit(env)) {
+      break;
+    }
+    env->vec_set(env, vec, i++, elem);
+  }
+  ts_tree_cursor_delete(&cursor);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return vec;
+}
+
+static const char *tsel_node_children_doc = "Return a vector of the children of NODE.\n"
+  "If TYPE is nil, t, or unspecified include all children. Otherwise, if\n"
+  "TYPE is the symbol 'named include only named children.\n"
+  "The children are collected in a single pass, unlike repeated calls to\n"
+  "`tree-sitter-node-child' which rescan the children for each index.\n"
+  "\n"
+  "(fn NODE &optional TYPE)";
+static emacs_value tsel_node_children(emacs_env *env,
+                                      ptrdiff_t nargs,
+                                      emacs_value *args,
+                                      __attribute__((unused)) void *data) {
+  TSElNode *node;
+  TSEL_SUBR_EXTRACT(node, env, args[0], &node);
+  bool named = nargs > 1 && tsel_named_nodes(env, args[1]);
+  return tsel_node_children_vector(env, node, named, NULL);
+}
+
+static const char *tsel_node_children_with_fields_doc = "Return a vector of the children of NODE with their fields.\n"
+  "Each element is a cons (CHILD . FIELD) where FIELD is the interned field\n"
+  "name symbol of CHILD in NODE, or nil if it has none.\n"
+  "If TYPE is nil, t, or unspecified include all children. Otherwise, if\n"
+  "TYPE is the symbol 'named include only named children.\n"
+  "\n"
+  "(fn NODE &optional TYPE)";
+static emacs_value tsel_node_children_with_fields(emacs_env *env,
+                                                  ptrdiff_t nargs,
+                                                  emacs_value *args,
+                                                  __attribute__((unused)) void *data) {
+  TSElNode *node;
+  TSEL_SUBR_EXTRACT(node, env, args[0], &node);
+  bool named = nargs > 1 && tsel_named_nodes(env, args[1]);
+  TSElLanguageCache *cache = tsel_node_language_cache(env, node);
+  if(!cache) {
+    return tsel_Qnil;
+  }
+  return tsel_node_children_vector(env, node, named, cache);
+}
+
+#define TSEL_WALK_BATCH_SIZE 256
+
+typedef struct tsel_walk_batch {
+  emacs_value function;
+  TSElTree *tree;
+  uint32_t count;
+  TSNode nodes[TSEL_WALK_BATCH_SIZE];
+} tsel_walk_batch;
+
+static bool tsel_walk_flush(emacs_env *env, tsel_walk_batch *batch) {
+  if(batch->count == 0) {
+    return true;
+  }
+  emacs_value vec = tsel_make_vector(env, batch->count, tsel_Qnil);
+  for(uint32_t i = 0; i < batch->count && !tsel_pending_nonlocal_exit(env); i++) {
+    env->vec_set(env, vec, i, tsel_node_emacs_move(env, batch->nodes[i], batch->tree));
+  }
+  batch->count = 0;
+  if(tsel_pending_nonlocal_exit(env)) {
+    return false;
+  }
+  env->funcall(env, batch->function, 1, &vec);
+  return !tsel_pending_nonlocal_exit(env);
+}
+
+static bool tsel_walk_in_range(TSNode node, uint32_t start, uint32_t end) {
+  uint32_t node_start = ts_node_start_byte(node);
+  uint32_t node_end = ts_node_end_byte(node);
+  if(node_start == node_end) {
+    return start <= node_start && node_start < end;
+  }
+  return node_start < end && node_end > start;
+}
+
+static const char *tsel_walk_doc = "Walk NODE and its descendants in preorder, calling FUNCTION in batches.\n"
+  "FUNCTION is called with a vector of up to 256 matching nodes at a time,\n"
+  "in preorder, so most of the walk never leaves native code.\n"
+  "SYMBOLS restricts which nodes are passed to FUNCTION. It is nil for all\n"
+  "nodes, a list of tree-sitter-symbol records, or a category name as for\n"
+  "`tree-sitter-language-category-p'. If TYPE is the symbol 'named only\n"
+  "named nodes are passed. Descendants deeper than MAX-DEPTH below NODE are\n"
+  "not visited. Subtrees outside the byte range from START to END are\n"
+  "skipped. Either may be nil to leave that side of the range open, and\n"
+  "values below 1 signal `args-out-of-range'.\n"
+  "\n"
+  "(fn NODE FUNCTION &optional SYMBOLS TYPE MAX-DEPTH START END)";
+static emacs_value tsel_walk(emacs_env *env,
+                             ptrdiff_t nargs,
+                             emacs_value *args,
+                             __attribute__((unused)) void *data) {
+  TSElNode *node;
+  intmax_t max_depth = -1, start = 1, end = (intmax_t) UINT32_MAX + 1;
+  TSEL_SUBR_EXTRACT(node, env, args[0], &node);
+  bool named = nargs > 3 && tsel_named_nodes(env, args[3]);
+  if(nargs > 4 && env->is_not_nil(env, args[4])) {
+    TSEL_SUBR_EXTRACT(integer, env, args[4], &max_depth);
+  }
+  // START and END are read independently, and positions past the last
+  // byte a tree can have mean the same as the last byte
+  if(nargs > 5 && env->is_not_nil(env, args[5])) {
+    TSEL_SUBR_EXTRACT(integer, env, args[5], &start);
+    if(start < 1) {
+      tsel_signal_args_out_of_range(env, args[5]);
+      return tsel_Qnil;
+    }
+  }
+  if(nargs > 6 && env->is_not_nil(env, args[6])) {
+    TSEL_SUBR_EXTRACT(integer, env, args[6], &end);
+    if(end < 1) {
+      tsel_signal_args_out_of_range(env, args[6]);
+      return tsel_Qnil;
+    }
+  }
+  if(start > (intmax_t) UINT32_MAX + 1) {
+    start = (intmax_t) UINT32_MAX + 1;
+  }
+  if(end > (intmax_t) UINT32_MAX + 1) {
+    end = (intmax_t) UINT32_MAX + 1;
+  }
+  TSElLanguageCache *cache = tsel_node_language_cache(env, node);
+  TSElSymbolSet storage, *symbols;
+  if(!cache || !tsel_language_symbol_filter(env, cache, nargs > 2 ? args[2] : tsel_Qnil,
+                                            &storage, &symbols)) {
+    return tsel_Qnil;
+  }
+  tsel_walk_batch *batch = malloc(sizeof(tsel_walk_batch));
+  if(!batch) {
+    if(symbols == &storage) {
+      tsel_symbol_set_free(&storage);
+    }
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  batch->function = args[1];
+  batch->tree = node->tree;
+  batch->count = 0;
+  uint32_t range_start = start - 1, range_end = end - 1;
+  intmax_t depth = 0;
+  bool ok = true;
+  TSTreeCursor cursor = ts_tree_cursor_new(node->node);
+  while(ok) {
+    TSNode current = ts_tree_cursor_current_node(&cursor);
+    bool in_range = tsel_walk_in_range(current, range_start, range_end);
+    if(in_range && (!named || ts_node_is_named(current)) &&
+       (!symbols || tsel_symbol_set_contains(symbols, ts_node_symbol(current)))) {
+      batch->nodes[batch->count++] = current;
+      if(batch->count == TSEL_WALK_BATCH_SIZE) {
+        ok = tsel_walk_flush(env, batch);
+      }
+    }
+    // Advance in preorder, pruning by depth and range
+    if(in_range && (max_depth < 0 || depth < max_depth) &&
+       ts_tree_cursor_goto_first_child(&cursor)) {
+      depth++;
+      continue;
+    }
+    while(depth > 0 && !ts_tree_cursor_goto_next_sibling(&cursor)) {
+      ts_tree_cursor_goto_parent(&cursor);
+      depth--;
+    }
+    if(depth == 0) {
+      break;
+    }
+  }
+  ts_tree_cursor_delete(&cursor);
+  if(ok) {
+    tsel_walk_flush(env, batch);
+  }
+  free(batch);
+  if(symbols == &storage) {
+    tsel_symbol_set_free(&storage);
+  }
+  return tsel_Qnil;
+}
+
+static bool tsel_node_path_to_node(TSNode root, TSNode target, TSElNodePath *path) {
+  // Descend along the target's byte range, which is O(depth) unlike
+  // ts_node_parent. Ties between zero-width siblings can send the
+  // descent down the wrong branch, so fall back to the parent chain.
+  uint32_t start = ts_node_start_byte(target), end = ts_node_end_byte(target);
+  TSNode current = root;
+  path->depth = 0;
+  while(true) {
+    if(!tsel_node_path_push(path, current)) {
+      return false;
+    }
+    if(ts_node_eq(current, target)) {
+      return true;
+    }
+    if(!tsel_node_child_containing(current, start, end, &current)) {
+      break;
+    }
+  }
+  path->depth = 0;
+  for(TSNode node = target; !ts_node_is_null(node); node = ts_node_parent(node)) {
+    if(!tsel_node_path_push(path, node)) {
+      return false;
+    }
+  }
+  for(uint32_t i = 0; i < path->depth / 2; i++) {
+    TSNode tmp = path->nodes[i];
+    path->nodes[i] = path->nodes[path->depth - 1 - i];
+    path->nodes[path->depth - 1 - i] = tmp;
+  }
+  return true;
+}
+
+static bool tsel_node_path_to_byte(TSNode top, uint32_t byte, TSElNodePath *path) {
+  path->depth = 0;
+  return tsel_node_path_push(path, top) && tsel_node_path_seek(path, byte);
+}
+
+static const char *tsel_node_ancestors_doc = "Return a vector of the nodes on a path through the tree of NODE.\n"
+  "If BYTE is nil the path runs from the root of the tree down to NODE.\n"
+  "Otherwise it runs from NODE down to the smallest node containing BYTE,\n"
+  "the same node `tree-sitter-node-descendant-for-byte-range' finds.\n"
+  "Both ends are included. The path is found in one descent, while\n"
+  "repeated `tree-sitter-node-parent' calls each start again from the root.\n"
+  "SYMBOLS and TYPE filter the nodes included as for `tree-sitter-walk'.\n"
+  "\n"
+  "(fn NODE &optional BYTE SYMBOLS TYPE)";
+static emacs_value tsel_node_ancestors(emacs_env *env,
+                                       ptrdiff_t nargs,
+                                       emacs_value *args,
+                                       __attribute__((unused)) void *data) {
+  TSElNode *node;
+  intmax_t byte = 0;
+  TSEL_SUBR_EXTRACT(node, env, args[0], &node);
+  bool to_byte = nargs > 1 && env->is_not_nil(env, args[1]);
+  if(to_byte) {
+    TSEL_SUBR_EXTRACT(integer, env, args[1], &byte);
+  }
+  bool named = nargs > 3 && tsel_named_nodes(env, args[3]);
+  TSElLanguageCache *cache = tsel_node_language_cache(env, node);
+  TSElSymbolSet storage, *symbols;
+  if(!cache || !tsel_language_symbol_filter(env, cache, nargs > 2 ? args[2] : tsel_Qnil,
+                                            &storage, &symbols)) {
+    return tsel_Qnil;
+  }
+  TSElNodePath path = {0};
+  bool found;
+  if(to_byte) {
+    found = tsel_node_path_to_byte(node->node, byte - 1, &path);
+  }
+  else {
+    found = tsel_node_path_to_node(ts_tree_root_node(node->tree->tree), node->node, &path);
+  }
+  emacs_value result = tsel_Qnil;
+  if(!found) {
+    tsel_signal_error(env, "Allocation failed.");
+  }
+  else {
+    // Keep only the nodes passing the filters, in place
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < path.depth; i++) {
+      TSNode current = path.nodes[i];
+      if((!named || ts_node_is_named(current)) &&
+         (!symbols || tsel_symbol_set_contains(symbols, ts_node_symbol(current)))) {
+        path.nodes[count++] = current;
+      }
+    }
+    result = tsel_make_vector(env, count, tsel_Qnil);
+    for(uint32_t i = 0; i < count && !tsel_pending_nonlocal_exit(env); i++) {
+      env->vec_set(env, result, i, tsel_node_emacs_move(env, path.nodes[i], node->tree));
+    }
+  }
+  tsel_node_path_free(&path);
+  if(symbols == &storage) {
+    tsel_symbol_set_free(&storage);
+  }
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return result;
+}
+
+static emacs_value tsel_node_text_fetch(emacs_env *env, emacs_value buffer, emacs_value bytes,
+                                        emacs_value no_properties, emacs_value max_length) {
+  emacs_value args[4] = { buffer, bytes, no_properties, max_length };
+  return env->funcall(env, Qts_node_text, 4, args);
+}
+
+static const char *tsel_node_text_doc = "Return the text of NODE from BUFFER.\n"
+  "BUFFER defaults to the current buffer and should hold the text NODE\n"
+  "was parsed from. If NO-PROPERTIES is non-nil the string has no text\n"
+  "properties. If MAX-LENGTH is non-nil at most that many characters\n"
+  "from the start of NODE are returned.\n"
+  "\n"
+  "(fn NODE &optional BUFFER NO-PROPERTIES MAX-LENGTH)";
+static emacs_value tsel_node_text(emacs_env *env,
+                                  ptrdiff_t nargs,
+                                  emacs_value *args,
+                                  __attribute__((unused)) void *data) {
+  TSElNode *node;
+  emacs_value buffer = tsel_Qnil;
+  TSEL_SUBR_EXTRACT(node, env, args[0], &node);
+  if(nargs > 1 && env->is_not_nil(env, args[1])) {
+    TSEL_SUBR_EXTRACT(buffer, env, args[1], &buffer);
+  }
+  emacs_value bytes = tsel_make_vector(env, 2, tsel_Qnil);
+  env->vec_set(env, bytes, 0, env->make_integer(env, ts_node_start_byte(node->node) + 1));
+  env->vec_set(env, bytes, 1, env->make_integer(env, ts_node_end_byte(node->node) + 1));
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  emacs_value strings = tsel_node_text_fetch(env, buffer, bytes,
+                                             nargs > 2 ? args[2] : tsel_Qnil,
+                                             nargs > 3 ? args[3] : tsel_Qnil);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return env->vec_get(env, strings, 0);
+}
+
+static const char *tsel_node_texts_doc = "Return a vector of the text of each node in NODES.\n"
+  "NODES is a vector of nodes. The text of all of them is read from\n"
+  "BUFFER in one pass. BUFFER, NO-PROPERTIES and MAX-LENGTH are as for\n"
+  "`tree-sitter-node-text'.\n"
+  "\n"
+  "(fn NODES &optional BUFFER NO-PROPERTIES MAX-LENGTH)";
+static emacs_value tsel_node_texts(emacs_env *env,
+                                   ptrdiff_t nargs,
+                                   emacs_value *args,
+                                   __attribute__((unused)) void *data) {
+  emacs_value buffer = tsel_Qnil;
+  if(nargs > 1 && env->is_not_nil(env, args[1])) {
+    TSEL_SUBR_EXTRACT(buffer, env, args[1], &buffer);
+  }
+  ptrdiff_t count = env->vec_size(env, args[0]);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  emacs_value bytes = tsel_make_vector(env, 2 * count, tsel_Qnil);
+  for(ptrdiff_t i = 0; i < count; i++) {
+    TSElNode *node;
+    if(!tsel_extract_node(env, env->vec_get(env, args[0], i), &node)) {
+      return tsel_Qnil;
+    }
+    env->vec_set(env, bytes, 2 * i, env->make_integer(env, ts_node_start_byte(node->node) + 1));
+    env->vec_set(env, bytes, 2 * i + 1, env->make_integer(env, ts_node_end_byte(node->node) + 1));
+  }
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return tsel_node_text_fetch(env, buffer, bytes,
+                              nargs > 2 ? args[2] : tsel_Qnil,
+                              nargs > 3 ? args[3] : tsel_Qnil);
+}
+
+#define TSEL_NODE_INFO_SIZE 6
+
+static const char *tsel_node_info_doc = "Return a vector of facts about NODE.\n"
+  "The vector holds, in order, the type of NODE as an interned symbol as\n"
+  "from `tree-sitter-node-type-symbol', its start byte, its end byte, t if\n"
+  "it is named, t if it has an error, and its number of children.\n"
+  "If VECTOR is non-nil it must have at least six elements. The facts are\n"
+  "stored into it and it is returned, so no new vector is allocated.\n"
+  "\n"
+  "(fn NODE &optional VECTOR)";
+static emacs_value tsel_node_info(emacs_env *env,
+                                  ptrdiff_t nargs,
+                                  emacs_value *args,
+                                  __attribute__((unused)) void *data) {
+  TSElNode *node;
+  TSEL_SUBR_EXTRACT(node, env, args[0], &node);
+  emacs_value result;
+  if(nargs > 1 && env->is_not_nil(env, args[1])) {
+    result = args[1];
+    if(env->vec_size(env, result) < TSEL_NODE_INFO_SIZE) {
+      if(!tsel_pending_nonlocal_exit(env)) {
+        tsel_signal_error(env, "Vector too short for node info.");
+      }
+      return tsel_Qnil;
+    }
+  }
+  else {
+    result = tsel_make_vector(env, TSEL_NODE_INFO_SIZE, tsel_Qnil);
+  }
+  emacs_value info[TSEL_NODE_INFO_SIZE] = {
+    tsel_node_type_symbol(env, node->node, node->tree),
+    env->make_integer(env, ts_node_start_byte(node->node) + 1),
+    env->make_integer(env, ts_node_end_byte(node->node) + 1),
+    ts_node_is_named(node->node) ? tsel_Qt : tsel_Qnil,
+    ts_node_has_error(node->node) ? tsel_Qt : tsel_Qnil,
+    env->make_integer(env, ts_node_child_count(node->node)),
+  };
+  for(int i = 0; i < TSEL_NODE_INFO_SIZE; i++) {
+    env->vec_set(env, result, i, info[i]);
+  }
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return result;
+}
+
 static const char *tsel_node_edit_doc = "Mark NODE as edited.\n"
   "\n"
   "(fn NODE START-BYTE OLD-END-BYTE NEW-END-BYTE START-POINT OLD-END-POINT NEW-END-POINT)";
@@ -411,6 +985,10 @@ static emacs_value tsel_node_edit(emacs_env *env,
 }
 
 bool tsel_node_init(emacs_env *env) {
+  Qts_node_text = env->make_global_ref(env, env->intern(env, "tree-sitter--node-text"));
+  if(tsel_pending_nonlocal_exit(env)) {
+    return false;
+  }
   bool function_result = tsel_define_function(env, "tree-sitter-node-p",
                                               &tsel_node_p_wrapped, 1, 1,
                                               tsel_node_p_wrapped_doc, NULL);
@@ -420,6 +998,9 @@ bool tsel_node_init(emacs_env *env) {
   function_result &= tsel_define_function(env, "tree-sitter-node-type",
                                           &tsel_node_type, 1, 1,
                                           tsel_node_type_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-node-type-symbol",
+                                          &tsel_node_type_symbol_wrapped, 1, 1,
+                                          tsel_node_type_symbol_doc, NULL);
   function_result &= tsel_define_function(env, "tree-sitter-node-start-byte",
                                           &tsel_node_start_byte, 1, 1,
                                           tsel_node_start_byte_doc, NULL);
@@ -474,6 +1055,36 @@ bool tsel_node_init(emacs_env *env) {
   function_result &= tsel_define_function(env, "tree-sitter-node-descendant-for-point-range",
                                           &tsel_node_descendant_for_point_range, 3, 4,
                                           tsel_node_descendant_for_point_range_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-node-child-by-field",
+                                          &tsel_node_child_by_field, 2, 2,
+                                          tsel_node_child_by_field_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-node-children-by-field",
+                                          &tsel_node_children_by_field, 2, 2,
+                                          tsel_node_children_by_field_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-node-children",
+                                          &tsel_node_children, 1, 2,
+                                          tsel_node_children_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-node-children-with-fields",
+                                          &tsel_node_children_with_fields, 1, 2,
+                                          tsel_node_children_with_fields_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-walk",
+                                          &tsel_walk, 2, 7,
+                                          tsel_walk_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-node-descendants-for-bytes",
+                                          &tsel_node_descendants_for_bytes, 2, 3,
+                                          tsel_node_descendants_for_bytes_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-node-ancestors",
+                                          &tsel_node_ancestors, 1, 4,
+                                          tsel_node_ancestors_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-node-text",
+                                          &tsel_node_text, 1, 4,
+                                          tsel_node_text_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-node-texts",
+                                          &tsel_node_texts, 1, 4,
+                                          tsel_node_texts_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-node-info",
+                                          &tsel_node_info, 1, 2,
+                                          tsel_node_info_doc, NULL);
   function_result &= tsel_define_function(env, "tree-sitter-node-edit",
                                           &tsel_node_edit, 7, 7,
                                           tsel_node_edit_doc, NULL);
@@ -506,6 +1117,94 @@ emacs_value tsel_node_emacs_move(emacs_env *env, TSNode node, TSElTree *tree) {
   return env->funcall(env, Qts_node_create, 1, func_args);
 }
 
+bool tsel_node_child_containing(TSNode parent, uint32_t start, uint32_t end, TSNode *child) {
+  // Same rule as ts_node_descendant_for_byte_range: the first child
+  // ending at or after END and after START, provided it starts at or
+  // before START. A child ending exactly at an empty range is passed
+  // over for the one starting there.
+  TSNode candidate = ts_node_first_child_for_byte(parent, end > start ? end - 1 : start);
+  if(ts_node_is_null(candidate) || ts_node_start_byte(candidate) > start ||
+     ts_node_end_byte(candidate) < end || ts_node_end_byte(candidate) <= start) {
+    return false;
+  }
+  *child = candidate;
+  return true;
+}
+
+bool tsel_node_path_push(TSElNodePath *path, TSNode node) {
+  if(path->depth == path->capacity) {
+    uint32_t capacity = path->capacity ? path->capacity * 2 : 32;
+    TSNode *nodes = realloc(path->nodes, capacity * sizeof(TSNode));
+    if(!nodes) {
+      return false;
+    }
+    path->nodes = nodes;
+    path->capacity = capacity;
+  }
+  path->nodes[path->depth++] = node;
+  return true;
+}
+
+bool tsel_node_path_seek(TSElNodePath *path, uint32_t byte) {
+  return tsel_node_path_seek_range(path, byte, byte);
+}
+
+static bool tsel_node_path_keeps(TSNode node, uint32_t start, uint32_t end) {
+  // Whether a fresh descent for START to END passes through NODE, as
+  // tsel_node_child_containing picks children: NODE contains the range
+  // and ends after START. No earlier sibling can also qualify, since it
+  // would have to end after START where NODE starts at or before it.
+  uint32_t node_start = ts_node_start_byte(node), node_end = ts_node_end_byte(node);
+  return node_start <= start && node_end >= end && node_end > start;
+}
+
+bool tsel_node_path_seek_range(TSElNodePath *path, uint32_t start, uint32_t end) {
+  // Climb to the deepest node a fresh descent would also reach, then
+  // descend again, so the answer never depends on the previous seek.
+  // The first node of the path is never removed.
+  while(path->depth > 1 && !tsel_node_path_keeps(path->nodes[path->depth - 1], start, end)) {
+    path->depth--;
+  }
+  TSNode current = path->nodes[path->depth - 1];
+  while(tsel_node_child_containing(current, start, end, &current)) {
+    if(!tsel_node_path_push(path, current)) {
+      return false;
+    }
+  }
+#ifdef TSEL_CHECK_PATHS
+  // Compare with tree-sitter's own lookup from the first node of the path
+  TSNode fresh = ts_node_descendant_for_byte_range(path->nodes[0], start, end);
+  assert(ts_node_eq(fresh, path->nodes[path->depth - 1]));
+#endif
+  return true;
+}
+
+void tsel_node_path_free(TSElNodePath *path) {
+  free(path->nodes);
+  path->nodes = NULL;
+  path->depth = 0;
+  path->capacity = 0;
+}
+
+TSElLanguageCache *tsel_node_language_cache(emacs_env *env, TSElNode *node) {
+  TSElLanguageCache *cache = tsel_language_cache(ts_tree_language(node->tree->tree));
+  if(!cache) {
+    tsel_signal_error(env, "Allocation failed.");
+  }
+  return cache;
+}
+
+emacs_value tsel_node_type_symbol(emacs_env *env, TSNode node, TSElTree *tree) {
+  TSElLanguageCache *cache = tsel_language_cache(ts_tree_language(tree->tree));
+  TSSymbol symbol = ts_node_symbol(node);
+  if(cache && symbol < cache->symbol_count) {
+    return tsel_language_type_symbol(env, cache, symbol);
+  }
+  // Builtin symbols such as ERROR are outside the language's table
+  const char *name = ts_node_type(node);
+  return tsel_intern_string(env, name, strlen(name));
+}
+
 bool tsel_node_p(emacs_env *env, emacs_value obj) {
   if(!tsel_check_record_type(env, "tree-sitter-node", obj, 1)) {
     return false;
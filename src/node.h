@@ -24,15 +24,30 @@
 #include <emacs-module.h>
 #include "tree_sitter/api.h"
 #include "tree.h"
+#include "language.h"
 
 typedef struct TSElNode {
   TSNode node;
   TSElTree *tree;
 } TSElNode;
 
+// A root to leaf chain of nodes
+typedef struct TSElNodePath {
+  TSNode *nodes;
+  uint32_t depth;
+  uint32_t capacity;
+} TSElNodePath;
+
 bool tsel_node_init(emacs_env *env);
 void tsel_node_free(TSElNode *node);
 emacs_value tsel_node_emacs_move(emacs_env *env, TSNode node, TSElTree *tree);
+TSElLanguageCache *tsel_node_language_cache(emacs_env *env, TSElNode *node);
+emacs_value tsel_node_type_symbol(emacs_env *env, TSNode node, TSElTree *tree);
+bool tsel_node_child_containing(TSNode parent, uint32_t start, uint32_t end, TSNode *child);
+bool tsel_node_path_push(TSElNodePath *path, TSNode node);
+bool tsel_node_path_seek(TSElNodePath *path, uint32_t byte);
+bool tsel_node_path_seek_range(TSElNodePath *path, uint32_t start, uint32_t end);
+void tsel_node_path_free(TSElNodePath *path);
 bool tsel_node_p(emacs_env *env, emacs_value obj);
 bool tsel_extract_node(emacs_env *env, emacs_value obj, TSElNode **node);
 
@@ -0,0 +1,504 @@
+/*
+ * Copyright (C) 2019 Karl Otness
+ *
+ * This file is part of tree-sitter.el.
+ *
+ * tree-sitter.el is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * tree-sitter.el is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tree-sitter.el. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "parallel.h"
+#include "common.h"
+#include "tree.h"
+#include "query.h"
+#include "qcursor.h"
+
+typedef struct tsel_parallel_pool {
+  pthread_mutex_t lock;
+  uint32_t next;
+  uint32_t jobs;
+  tsel_parallel_job run;
+  void *context;
+  TSElParallelStats *stats;
+} tsel_parallel_pool;
+
+typedef struct tsel_parallel_worker {
+  tsel_parallel_pool *pool;
+  uint32_t index;
+} tsel_parallel_worker;
+
+static void *tsel_parallel_worker_main(void *arg) {
+  tsel_parallel_worker *worker = arg;
+  tsel_parallel_pool *pool = worker->pool;
+  TSElParallelStats *stats = &pool->stats[worker->index];
+  while(true) {
+    pthread_mutex_lock(&pool->lock);
+    uint32_t job = pool->next;
+    if(job < pool->jobs) {
+      pool->next++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if(job >= pool->jobs) {
+      break;
+    }
+    double start = tsel_now();
+    pool->run(pool->context, worker->index, job);
+    stats->seconds += tsel_now() - start;
+    stats->jobs++;
+  }
+  return NULL;
+}
+
+uint32_t tsel_parallel_default_threads(void) {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? count : 1;
+}
+
+bool tsel_parallel_run(uint32_t threads, uint32_t jobs, tsel_parallel_job run,
+                       void *context, TSElParallelStats *stats) {
+  // Jobs are handed out one at a time from a shared counter. The
+  // calling thread acts as worker 0. STATS has room for THREADS
+  // workers; those never started keep zero stats.
+  memset(stats, 0, threads * sizeof(TSElParallelStats));
+  if(threads > jobs) {
+    threads = jobs > 0 ? jobs : 1;
+  }
+  tsel_parallel_pool pool = { .next = 0, .jobs = jobs, .run = run,
+                              .context = context, .stats = stats };
+  pthread_t *ids = malloc(threads * sizeof(pthread_t));
+  tsel_parallel_worker *workers = malloc(threads * sizeof(tsel_parallel_worker));
+  if(!ids || !workers || pthread_mutex_init(&pool.lock, NULL) != 0) {
+    free(ids);
+    free(workers);
+    return false;
+  }
+  uint32_t started = 1;
+  for(uint32_t i = 0; i < threads; i++) {
+    workers[i].pool = &pool;
+    workers[i].index = i;
+  }
+  // Fewer threads than asked for only costs speed
+  for(uint32_t i = 1; i < threads; i++) {
+    if(pthread_create(&ids[i], NULL, &tsel_parallel_worker_main, &workers[i]) != 0) {
+      break;
+    }
+    started++;
+  }
+  tsel_parallel_worker_main(&workers[0]);
+  for(uint32_t i = 1; i < started; i++) {
+    pthread_join(ids[i], NULL);
+  }
+  pthread_mutex_destroy(&pool.lock);
+  free(ids);
+  free(workers);
+  return true;
+}
+
+static emacs_value tsel_parallel_timings(emacs_env *env, TSElParallelStats *stats, uint32_t threads) {
+  emacs_value timings = tsel_make_vector(env, threads, tsel_Qnil);
+  for(uint32_t i = 0; i < threads && !tsel_pending_nonlocal_exit(env); i++) {
+    emacs_value timing = tsel_make_vector(env, 2, tsel_Qnil);
+    env->vec_set(env, timing, 0, env->make_integer(env, stats[i].jobs));
+    env->vec_set(env, timing, 1, env->make_float(env, stats[i].seconds));
+    env->vec_set(env, timings, i, timing);
+  }
+  return timings;
+}
+
+static bool tsel_parallel_extract_threads(emacs_env *env, ptrdiff_t nargs, emacs_value *args,
+                                          ptrdiff_t index, uint32_t *threads) {
+  *threads = tsel_parallel_default_threads();
+  if(nargs <= index || !env->is_not_nil(env, args[index])) {
+    return true;
+  }
+  intmax_t requested;
+  if(!tsel_extract_integer(env, args[index], &requested)) {
+    return false;
+  }
+  if(requested < 1 || requested > 1024) {
+    tsel_signal_error(env, "Thread count out of range.");
+    return false;
+  }
+  *threads = requested;
+  return true;
+}
+
+typedef struct tsel_parallel_trees {
+  TSElQuery *query;
+  uint32_t count;
+  TSTree **trees;
+  char **texts;
+  size_t *lengths;
+  TSQueryCursor **cursors;
+  uint32_t cursor_count;
+  TSElCaptureList *results;
+  bool *failed;
+} tsel_parallel_trees;
+
+static void tsel_parallel_trees_free(tsel_parallel_trees *ctx) {
+  for(uint32_t i = 0; i < ctx->count; i++) {
+    if(ctx->trees && ctx->trees[i]) {
+      ts_tree_delete(ctx->trees[i]);
+    }
+    if(ctx->texts) {
+      free(ctx->texts[i]);
+    }
+    if(ctx->results) {
+      free(ctx->results[i].items);
+    }
+  }
+  for(uint32_t i = 0; ctx->cursors && i < ctx->cursor_count; i++) {
+    if(ctx->cursors[i]) {
+      ts_query_cursor_delete(ctx->cursors[i]);
+    }
+  }
+  free(ctx->trees);
+  free(ctx->texts);
+  free(ctx->lengths);
+  free(ctx->cursors);
+  free(ctx->results);
+  free(ctx->failed);
+}
+
+static void tsel_parallel_trees_job(void *context, uint32_t worker, uint32_t job) {
+  tsel_parallel_trees *ctx = context;
+  TSQueryCursor *cursor = ctx->cursors[worker];
+  TSElTextSource source;
+  tsel_text_source_init_text(&source, ctx->texts[job], ctx->lengths[job]);
+  ts_query_cursor_exec(cursor, ctx->query->query, ts_tree_root_node(ctx->trees[job]));
+  TSElCapture capture;
+  while(tsel_qcursor_next(cursor, ctx->query->predicates, &source, &capture)) {
+    if(!tsel_capture_list_push(&ctx->results[job], &capture)) {
+      ctx->failed[job] = true;
+      break;
+    }
+  }
+  tsel_text_source_free(&source);
+}
+
+static bool tsel_parallel_trees_read(emacs_env *env, emacs_value list, tsel_parallel_trees *ctx) {
+  emacs_value Qconsp = env->intern(env, "consp");
+  emacs_value Qcar = env->intern(env, "car");
+  emacs_value Qcdr = env->intern(env, "cdr");
+  for(uint32_t i = 0; i < ctx->count; i++) {
+    emacs_value elem = env->funcall(env, Qcar, 1, &list);
+    list = env->funcall(env, Qcdr, 1, &list);
+    if(tsel_pending_nonlocal_exit(env)) {
+      return false;
+    }
+    emacs_value text = tsel_Qnil;
+    if(env->is_not_nil(env, env->funcall(env, Qconsp, 1, &elem))) {
+      text = env->funcall(env, Qcdr, 1, &elem);
+      elem = env->funcall(env, Qcar, 1, &elem);
+    }
+    TSElTree *tree;
+    if(tsel_pending_nonlocal_exit(env) || !tsel_extract_tree(env, elem, &tree)) {
+      return false;
+    }
+    if(env->is_not_nil(env, text)) {
+      if(!tsel_copy_text(env, text, &ctx->texts[i], &ctx->lengths[i])) {
+        return false;
+      }
+    }
+    else if(ctx->query->predicates) {
+      tsel_signal_error(env, "Query has text predicates, so each tree needs its text.");
+      return false;
+    }
+    // Each worker gets its own copy, which tree-sitter makes cheaply
+    ctx->trees[i] = ts_tree_copy(tree->tree);
+  }
+  return true;
+}
+
+static const char *tsel_query_run_parallel_doc = "Run QUERY over each tree in TREES using worker threads.\n"
+  "Each element of TREES is a tree, or a pair (TREE . TEXT) where TEXT is\n"
+  "the buffer or string TREE was parsed from. TEXT is needed when QUERY\n"
+  "has text predicates, since worker threads cannot read buffers. THREADS\n"
+  "defaults to the number of online processors.\n"
+  "Returns a pair (RESULTS . TIMINGS). RESULTS holds a vector of captures\n"
+  "for each tree, laid out as for `tree-sitter-query-captures'. TIMINGS\n"
+  "holds a vector [TREES SECONDS] for each thread, giving the number of\n"
+  "trees it queried and the time it spent on them.\n"
+  "\n"
+  "(fn QUERY TREES &optional THREADS)";
+static emacs_value tsel_query_run_parallel(emacs_env *env,
+                                           ptrdiff_t nargs,
+                                           emacs_value *args,
+                                           __attribute__((unused)) void *data) {
+  TSElQuery *query;
+  uint32_t threads;
+  TSEL_SUBR_EXTRACT(query, env, args[0], &query);
+  if(!tsel_parallel_extract_threads(env, nargs, args, 2, &threads)) {
+    return tsel_Qnil;
+  }
+  emacs_value Qlength = env->intern(env, "length");
+  intmax_t count = env->extract_integer(env, env->funcall(env, Qlength, 1, &args[1]));
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  tsel_parallel_trees ctx = { .query = query, .count = count, .cursor_count = threads };
+  ctx.trees = calloc(count + 1, sizeof(TSTree *));
+  ctx.texts = calloc(count + 1, sizeof(char *));
+  ctx.lengths = calloc(count + 1, sizeof(size_t));
+  ctx.results = calloc(count + 1, sizeof(TSElCaptureList));
+  ctx.failed = calloc(count + 1, sizeof(bool));
+  ctx.cursors = calloc(threads, sizeof(TSQueryCursor *));
+  TSElParallelStats *stats = calloc(threads, sizeof(TSElParallelStats));
+  bool ok = ctx.trees && ctx.texts && ctx.lengths && ctx.results && ctx.failed &&
+    ctx.cursors && stats;
+  for(uint32_t i = 0; ok && i < threads; i++) {
+    ok = (ctx.cursors[i] = ts_query_cursor_new()) != NULL;
+  }
+  if(!ok) {
+    tsel_signal_error(env, "Allocation failed.");
+  }
+  ok = ok && tsel_parallel_trees_read(env, args[1], &ctx);
+  if(ok && !tsel_parallel_run(threads, ctx.count, &tsel_parallel_trees_job, &ctx, stats)) {
+    tsel_signal_error(env, "Failed to start worker threads.");
+    ok = false;
+  }
+  for(uint32_t i = 0; ok && i < ctx.count; i++) {
+    if(ctx.failed[i]) {
+      tsel_signal_error(env, "Allocation failed.");
+      ok = false;
+    }
+  }
+  emacs_value results = tsel_Qnil;
+  if(ok) {
+    results = tsel_make_vector(env, ctx.count, tsel_Qnil);
+  }
+  for(uint32_t i = 0; ok && i < ctx.count; i++) {
+    // The nodes keep the copy alive through its new wrapper
+    TSElTree *tree = tsel_tree_wrap(ctx.trees[i]);
+    if(!tree) {
+      tsel_signal_error(env, "Allocation failed.");
+      break;
+    }
+    ctx.trees[i] = NULL;
+    TSElCaptureList *list = &ctx.results[i];
+    emacs_value captures = tsel_make_vector(env, list->count * TSEL_CAPTURE_ENTRY_SIZE, tsel_Qnil);
+    for(size_t j = 0; j < list->count && !tsel_pending_nonlocal_exit(env); j++) {
+      tsel_qcursor_capture_entry(env, captures, j * TSEL_CAPTURE_ENTRY_SIZE,
+                                 query, &list->items[j], tree);
+    }
+    tsel_tree_release(tree);
+    env->vec_set(env, results, i, captures);
+    ok = !tsel_pending_nonlocal_exit(env);
+  }
+  emacs_value result = tsel_Qnil;
+  if(ok && !tsel_pending_nonlocal_exit(env)) {
+    emacs_value pair[2] = { results, tsel_parallel_timings(env, stats, threads) };
+    result = env->funcall(env, env->intern(env, "cons"), 2, pair);
+  }
+  tsel_parallel_trees_free(&ctx);
+  free(stats);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return result;
+}
+
+typedef struct tsel_parallel_parts {
+  TSElQuery *query;
+  // Start byte of each part. The first starts at 0 and the last runs
+  // to the end of the tree.
+  uint32_t *starts;
+  uint32_t count;
+  TSTree **trees;
+  TSQueryCursor **cursors;
+  uint32_t worker_count;
+  char *text;
+  size_t length;
+  TSElCaptureList *results;
+  bool *failed;
+} tsel_parallel_parts;
+
+static void tsel_parallel_parts_free(tsel_parallel_parts *ctx) {
+  for(uint32_t i = 0; i < ctx->worker_count; i++) {
+    if(ctx->trees && ctx->trees[i]) {
+      ts_tree_delete(ctx->trees[i]);
+    }
+    if(ctx->cursors && ctx->cursors[i]) {
+      ts_query_cursor_delete(ctx->cursors[i]);
+    }
+  }
+  for(uint32_t i = 0; ctx->results && i < ctx->count; i++) {
+    free(ctx->results[i].items);
+  }
+  free(ctx->starts);
+  free(ctx->trees);
+  free(ctx->cursors);
+  free(ctx->text);
+  free(ctx->results);
+  free(ctx->failed);
+}
+
+static bool tsel_parallel_partition(TSNode root, uint32_t parts, tsel_parallel_parts *ctx) {
+  // Split between children of the topmost node with more than one
+  // child, into parts of roughly equal size
+  TSNode node = root;
+  while(ts_node_child_count(node) == 1) {
+    node = ts_node_child(node, 0);
+  }
+  uint32_t children = ts_node_child_count(node);
+  uint32_t step = (ts_node_end_byte(node) - ts_node_start_byte(node)) / parts;
+  ctx->starts = malloc((children + 1) * sizeof(uint32_t));
+  if(!ctx->starts) {
+    return false;
+  }
+  ctx->starts[0] = 0;
+  ctx->count = 1;
+  uint32_t last = ts_node_start_byte(node);
+  TSTreeCursor cursor = ts_tree_cursor_new(node);
+  bool more = ts_tree_cursor_goto_first_child(&cursor);
+  while(more && ctx->count < parts) {
+    uint32_t start = ts_node_start_byte(ts_tree_cursor_current_node(&cursor));
+    if(start > last && start - last >= step) {
+      ctx->starts[ctx->count++] = start;
+      last = start;
+    }
+    more = ts_tree_cursor_goto_next_sibling(&cursor);
+  }
+  ts_tree_cursor_delete(&cursor);
+  return true;
+}
+
+static void tsel_parallel_parts_job(void *context, uint32_t worker, uint32_t job) {
+  tsel_parallel_parts *ctx = context;
+  TSQueryCursor *cursor = ctx->cursors[worker];
+  uint32_t start = ctx->starts[job];
+  uint32_t end = job + 1 < ctx->count ? ctx->starts[job + 1] : UINT32_MAX;
+  // The cursor range reaches one byte past the part on either side so
+  // empty nodes on its edges are found. A capture is kept only by the
+  // part it starts in: every part returns the whole of the matches
+  // overlapping it, so matches crossing an edge come back more than
+  // once. Keeping captures by start byte also leaves the parts in
+  // document order, so joining them gives the order of a single cursor.
+  ts_query_cursor_set_byte_range(cursor, start > 0 ? start - 1 : 0,
+                                 end < UINT32_MAX ? end + 1 : end);
+  ts_query_cursor_exec(cursor, ctx->query->query, ts_tree_root_node(ctx->trees[worker]));
+  TSElTextSource source;
+  tsel_text_source_init_text(&source, ctx->text, ctx->length);
+  TSElCapture capture;
+  while(tsel_qcursor_next(cursor, ctx->query->predicates, &source, &capture)) {
+    uint32_t byte = ts_node_start_byte(capture.node);
+    if(byte < start || byte >= end) {
+      continue;
+    }
+    if(!tsel_capture_list_push(&ctx->results[job], &capture)) {
+      ctx->failed[job] = true;
+      break;
+    }
+  }
+  tsel_text_source_free(&source);
+}
+
+static const char *tsel_query_captures_parallel_doc = "Run QUERY over all of TREE, splitting the work across worker threads.\n"
+  "The tree is cut between top-level nodes into parts of similar size,\n"
+  "and each part is queried on its own. The result is the same vector\n"
+  "`tree-sitter-query-captures' returns for the root node of TREE.\n"
+  "Text predicates in QUERY are checked against BUFFER, which defaults to\n"
+  "the current buffer. Its text is copied once before the threads start.\n"
+  "THREADS defaults to the number of online processors.\n"
+  "\n"
+  "(fn QUERY TREE &optional BUFFER THREADS)";
+static emacs_value tsel_query_captures_parallel(emacs_env *env,
+                                                ptrdiff_t nargs,
+                                                emacs_value *args,
+                                                __attribute__((unused)) void *data) {
+  TSElQuery *query;
+  TSElTree *tree;
+  uint32_t threads;
+  TSEL_SUBR_EXTRACT(query, env, args[0], &query);
+  TSEL_SUBR_EXTRACT(tree, env, args[1], &tree);
+  if(!tsel_parallel_extract_threads(env, nargs, args, 3, &threads)) {
+    return tsel_Qnil;
+  }
+  tsel_parallel_parts ctx = { .query = query, .worker_count = threads };
+  if(query->predicates) {
+    emacs_value buffer = nargs > 2 && env->is_not_nil(env, args[2]) ? args[2] :
+      env->funcall(env, env->intern(env, "current-buffer"), 0, NULL);
+    if(tsel_pending_nonlocal_exit(env) ||
+       !tsel_copy_text(env, buffer, &ctx.text, &ctx.length)) {
+      return tsel_Qnil;
+    }
+  }
+  // A few parts per thread even out parts of uneven cost
+  bool ok = tsel_parallel_partition(ts_tree_root_node(tree->tree), threads * 4, &ctx);
+  ctx.trees = ok ? calloc(threads, sizeof(TSTree *)) : NULL;
+  ctx.cursors = ok ? calloc(threads, sizeof(TSQueryCursor *)) : NULL;
+  ctx.results = ok ? calloc(ctx.count, sizeof(TSElCaptureList)) : NULL;
+  ctx.failed = ok ? calloc(ctx.count, sizeof(bool)) : NULL;
+  TSElParallelStats *stats = calloc(threads, sizeof(TSElParallelStats));
+  ok = ctx.trees && ctx.cursors && ctx.results && ctx.failed && stats;
+  for(uint32_t i = 0; ok && i < threads; i++) {
+    // Trees are not safe to share between threads, copies are
+    ok = (ctx.trees[i] = ts_tree_copy(tree->tree)) != NULL &&
+      (ctx.cursors[i] = ts_query_cursor_new()) != NULL;
+  }
+  if(!ok) {
+    tsel_parallel_parts_free(&ctx);
+    free(stats);
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  ok = tsel_parallel_run(threads, ctx.count, &tsel_parallel_parts_job, &ctx, stats);
+  free(stats);
+  if(!ok) {
+    tsel_parallel_parts_free(&ctx);
+    tsel_signal_error(env, "Failed to start worker threads.");
+    return tsel_Qnil;
+  }
+  size_t count = 0;
+  for(uint32_t i = 0; i < ctx.count; i++) {
+    ok = ok && !ctx.failed[i];
+    count += ctx.results[i].count;
+  }
+  if(!ok) {
+    tsel_parallel_parts_free(&ctx);
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  emacs_value result = tsel_make_vector(env, count * TSEL_CAPTURE_ENTRY_SIZE, tsel_Qnil);
+  ptrdiff_t offset = 0;
+  for(uint32_t i = 0; i < ctx.count && !tsel_pending_nonlocal_exit(env); i++) {
+    TSElCaptureList *list = &ctx.results[i];
+    for(size_t j = 0; j < list->count && !tsel_pending_nonlocal_exit(env); j++) {
+      // The copies share their nodes with TREE, so only the tree the
+      // node points to has to change before the copy goes away
+      list->items[j].node.tree = tree->tree;
+      tsel_qcursor_capture_entry(env, result, offset, query, &list->items[j], tree);
+      offset += TSEL_CAPTURE_ENTRY_SIZE;
+    }
+  }
+  tsel_parallel_parts_free(&ctx);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return result;
+}
+
+bool tsel_parallel_init(emacs_env *env) {
+  bool function_result = tsel_define_function(env, "tree-sitter-query-run-parallel",
+                                              &tsel_query_run_parallel, 2, 3,
+                                              tsel_query_run_parallel_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-query-captures-parallel",
+                                          &tsel_query_captures_parallel, 2, 4,
+                                          tsel_query_captures_parallel_doc, NULL);
+  return function_result;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2019 Karl Otness
+ *
+ * This file is part of tree-sitter.el.
+ *
+ * tree-sitter.el is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * tree-sitter.el is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tree-sitter.el. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#ifndef TSEL_PARALLEL_H
+#define TSEL_PARALLEL_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <emacs-module.h>
+
+// Busy time and number of jobs run by one worker thread
+typedef struct TSElParallelStats {
+  double seconds;
+  uint32_t jobs;
+} TSElParallelStats;
+
+// Run job JOB on worker WORKER. Must not call into Emacs.
+typedef void (*tsel_parallel_job)(void *context, uint32_t worker, uint32_t job);
+
+bool tsel_parallel_run(uint32_t threads, uint32_t jobs, tsel_parallel_job run,
+                       void *context, TSElParallelStats *stats);
+uint32_t tsel_parallel_default_threads(void);
+bool tsel_parallel_init(emacs_env *env);
+
+#endif //ifndef TSEL_PARALLEL_H
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2019 Karl Otness
+ *
+ * This file is part of tree-sitter.el.
+ *
+ * tree-sitter.el is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * tree-sitter.el is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tree-sitter.el. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "pool.h"
+
+/*
+ * Size-class pool allocator installed into tree-sitter with
+ * ts_set_allocator. Parsing allocates and frees many small blocks of
+ * a handful of sizes (subtrees, stack nodes, reusable arrays), so
+ * these are served from per-class free lists. Each thread keeps a
+ * small cache of free blocks per class and only takes the global lock
+ * to refill or drain that cache. Blocks larger than the biggest class
+ * go straight to the system allocator.
+ *
+ * Every block starts with a 16 byte header recording its class (or
+ * its size, for large blocks) so that free and realloc work without a
+ * size argument. The header also keeps the payload 16 byte aligned.
+ *
+ * Chunks are never given back to the system. Blocks of one chunk end
+ * up spread over the free lists of every thread, so finding a wholly
+ * free chunk would cost a header per block and a scan of the lists.
+ * Memory held by the pools instead stays at the most blocks ever in
+ * use at once for each class. Large blocks are freed as usual, and
+ * tsel_pool_retained_bytes reports what the chunks hold.
+ */
+
+#define TSEL_POOL_CLASS_COUNT 10
+#define TSEL_POOL_LARGE ((size_t) -1)
+#define TSEL_POOL_CHUNK_SIZE (64 * 1024)
+#define TSEL_POOL_CACHE_LIMIT 256
+#define TSEL_POOL_BATCH 64
+
+static const size_t tsel_pool_class_sizes[TSEL_POOL_CLASS_COUNT] = {
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512
+};
+
+typedef struct tsel_pool_header {
+  size_t class_index;
+  size_t size;
+} tsel_pool_header;
+
+typedef struct tsel_pool_block {
+  struct tsel_pool_block *next;
+} tsel_pool_block;
+
+typedef struct tsel_pool_list {
+  tsel_pool_block *head;
+  uint32_t count;
+} tsel_pool_list;
+
+static tsel_pool_list tsel_pool_global[TSEL_POOL_CLASS_COUNT];
+static size_t tsel_pool_chunk_bytes = 0;
+static pthread_mutex_t tsel_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t tsel_pool_cache_key;
+static pthread_once_t tsel_pool_key_once = PTHREAD_ONCE_INIT;
+static __thread tsel_pool_list tsel_pool_cache[TSEL_POOL_CLASS_COUNT];
+static __thread bool tsel_pool_cache_registered = false;
+
+static int tsel_pool_class_for_size(size_t size) {
+  for(int i = 0; i < TSEL_POOL_CLASS_COUNT; i++) {
+    if(size <= tsel_pool_class_sizes[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static inline void *tsel_pool_payload(tsel_pool_header *header) {
+  return (char*) header + sizeof(tsel_pool_header);
+}
+
+static inline tsel_pool_header *tsel_pool_header_of(void *payload) {
+  return (tsel_pool_header*) ((char*) payload - sizeof(tsel_pool_header));
+}
+
+// Move up to count blocks from src to dst. Returns the number moved.
+static uint32_t tsel_pool_list_move(tsel_pool_list *dst, tsel_pool_list *src, uint32_t count) {
+  uint32_t moved = 0;
+  while(moved < count && src->head) {
+    tsel_pool_block *block = src->head;
+    src->head = block->next;
+    block->next = dst->head;
+    dst->head = block;
+    moved++;
+  }
+  src->count -= moved;
+  dst->count += moved;
+  return moved;
+}
+
+// Return all blocks cached by an exiting thread to the global lists.
+static void tsel_pool_cache_flush(void *cache_ptr) {
+  tsel_pool_list *cache = cache_ptr;
+  pthread_mutex_lock(&tsel_pool_lock);
+  for(int i = 0; i < TSEL_POOL_CLASS_COUNT; i++) {
+    tsel_pool_list_move(&tsel_pool_global[i], &cache[i], cache[i].count);
+  }
+  pthread_mutex_unlock(&tsel_pool_lock);
+}
+
+static void tsel_pool_make_key(void) {
+  pthread_key_create(&tsel_pool_cache_key, &tsel_pool_cache_flush);
+}
+
+static void tsel_pool_register_cache(void) {
+  pthread_once(&tsel_pool_key_once, &tsel_pool_make_key);
+  pthread_setspecific(tsel_pool_cache_key, tsel_pool_cache);
+  tsel_pool_cache_registered = true;
+}
+
+// Refill the calling thread's cache for class_index. Must hold the lock.
+static bool tsel_pool_refill(int class_index) {
+  tsel_pool_list *cache = &tsel_pool_cache[class_index];
+  if(tsel_pool_list_move(cache, &tsel_pool_global[class_index], TSEL_POOL_BATCH) > 0) {
+    return true;
+  }
+  // Global list is empty, carve a new chunk into blocks
+  size_t block_size = sizeof(tsel_pool_header) + tsel_pool_class_sizes[class_index];
+  char *chunk = malloc(TSEL_POOL_CHUNK_SIZE);
+  if(!chunk) {
+    return false;
+  }
+  tsel_pool_chunk_bytes += TSEL_POOL_CHUNK_SIZE;
+  for(size_t offset = 0; offset + block_size <= TSEL_POOL_CHUNK_SIZE; offset += block_size) {
+    tsel_pool_block *block = (tsel_pool_block*) (chunk + offset);
+    block->next = cache->head;
+    cache->head = block;
+    cache->count++;
+  }
+  return true;
+}
+
+void *tsel_pool_malloc(size_t size) {
+  int class_index = tsel_pool_class_for_size(size);
+  if(class_index < 0) {
+    tsel_pool_header *header = malloc(sizeof(tsel_pool_header) + size);
+    if(!header) {
+      return NULL;
+    }
+    header->class_index = TSEL_POOL_LARGE;
+    header->size = size;
+    return tsel_pool_payload(header);
+  }
+  if(!tsel_pool_cache_registered) {
+    tsel_pool_register_cache();
+  }
+  tsel_pool_list *cache = &tsel_pool_cache[class_index];
+  if(!cache->head) {
+    pthread_mutex_lock(&tsel_pool_lock);
+    bool refilled = tsel_pool_refill(class_index);
+    pthread_mutex_unlock(&tsel_pool_lock);
+    if(!refilled) {
+      return NULL;
+    }
+  }
+  tsel_pool_block *block = cache->head;
+  cache->head = block->next;
+  cache->count--;
+  tsel_pool_header *header = (tsel_pool_header*) block;
+  header->class_index = class_index;
+  header->size = size;
+  return tsel_pool_payload(header);
+}
+
+void tsel_pool_free(void *ptr) {
+  if(!ptr) {
+    return;
+  }
+  tsel_pool_header *header = tsel_pool_header_of(ptr);
+  if(header->class_index == TSEL_POOL_LARGE) {
+    free(header);
+    return;
+  }
+  if(!tsel_pool_cache_registered) {
+    tsel_pool_register_cache();
+  }
+  size_t class_index = header->class_index;
+  tsel_pool_list *cache = &tsel_pool_cache[class_index];
+  tsel_pool_block *block = (tsel_pool_block*) header;
+  block->next = cache->head;
+  cache->head = block;
+  cache->count++;
+  if(cache->count > TSEL_POOL_CACHE_LIMIT) {
+    pthread_mutex_lock(&tsel_pool_lock);
+    tsel_pool_list_move(&tsel_pool_global[class_index], cache, TSEL_POOL_CACHE_LIMIT / 2);
+    pthread_mutex_unlock(&tsel_pool_lock);
+  }
+}
+
+void *tsel_pool_calloc(size_t count, size_t size) {
+  if(size != 0 && count > ((size_t) -1) / size) {
+    return NULL;
+  }
+  void *ptr = tsel_pool_malloc(count * size);
+  if(ptr) {
+    memset(ptr, 0, count * size);
+  }
+  return ptr;
+}
+
+void *tsel_pool_realloc(void *ptr, size_t size) {
+  if(!ptr) {
+    return tsel_pool_malloc(size);
+  }
+  tsel_pool_header *header = tsel_pool_header_of(ptr);
+  if(header->class_index == TSEL_POOL_LARGE) {
+    if(tsel_pool_class_for_size(size) < 0) {
+      // Large to large, let the system allocator resize in place
+      tsel_pool_header *resized = realloc(header, sizeof(tsel_pool_header) + size);
+      if(!resized) {
+        return NULL;
+      }
+      resized->size = size;
+      return tsel_pool_payload(resized);
+    }
+  }
+  else if(size <= tsel_pool_class_sizes[header->class_index]) {
+    header->size = size;
+    return ptr;
+  }
+  void *new_ptr = tsel_pool_malloc(size);
+  if(!new_ptr) {
+    return NULL;
+  }
+  memcpy(new_ptr, ptr, header->size < size ? header->size : size);
+  tsel_pool_free(ptr);
+  return new_ptr;
+}
+
+size_t tsel_pool_retained_bytes(void) {
+  pthread_mutex_lock(&tsel_pool_lock);
+  size_t bytes = tsel_pool_chunk_bytes;
+  pthread_mutex_unlock(&tsel_pool_lock);
+  return bytes;
+}
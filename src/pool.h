@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2019 Karl Otness
+ *
+ * This file is part of tree-sitter.el.
+ *
+ * tree-sitter.el is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * tree-sitter.el is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tree-sitter.el. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#ifndef TSEL_POOL_H
+#define TSEL_POOL_H
+#include <stdbool.h>
+#include <stddef.h>
+
+// Size-class pools for tree-sitter's allocations, see src/pool.c. The
+// module installs these when built with TSEL_POOL_ALLOCATOR.
+void *tsel_pool_malloc(size_t size);
+void *tsel_pool_calloc(size_t count, size_t size);
+void *tsel_pool_realloc(void *ptr, size_t size);
+void tsel_pool_free(void *ptr);
+// Bytes of chunks carved into pool blocks, which are never released
+size_t tsel_pool_retained_bytes(void);
+
+#endif //ifndef TSEL_POOL_H
@@ -0,0 +1,361 @@
+/*
+ * Copyright (C) 2019 Karl Otness
+ *
+ * This file is part of tree-sitter.el.
+ *
+ * tree-sitter.el is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * tree-sitter.el is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tree-sitter.el. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "predicate.h"
+#include "common.h"
+#include "node.h"
+
+static void tsel_predicate_free(TSElPredicate *predicate) {
+  if(predicate->type == TSEL_PREDICATE_MATCH) {
+    regfree(&predicate->regex);
+  }
+  free(predicate->strings);
+  free(predicate->lengths);
+}
+
+static bool tsel_predicate_add_string(const TSQuery *query, TSElPredicate *predicate,
+                                      uint32_t string_id) {
+  uint32_t index = predicate->string_count;
+  const char **strings = realloc(predicate->strings, (index + 1) * sizeof(char *));
+  if(!strings) {
+    return false;
+  }
+  predicate->strings = strings;
+  uint32_t *lengths = realloc(predicate->lengths, (index + 1) * sizeof(uint32_t));
+  if(!lengths) {
+    return false;
+  }
+  predicate->lengths = lengths;
+  // The strings live as long as the query, which owns the predicates
+  strings[index] = ts_query_string_value_for_id(query, string_id, &lengths[index]);
+  predicate->string_count++;
+  return true;
+}
+
+// Parse one predicate from STEPS, which holds COUNT steps without the
+// terminating Done step. Returns 1 for a predicate stored in
+// PREDICATE, 0 for one this module does not evaluate and -1 on error.
+static int tsel_predicate_parse(const TSQuery *query, const TSQueryPredicateStep *steps,
+                                uint32_t count, TSElPredicate *predicate,
+                                char *error, size_t error_size) {
+  if(count == 0 || steps[0].type != TSQueryPredicateStepTypeString) {
+    snprintf(error, error_size, "Predicate must start with a name");
+    return -1;
+  }
+  uint32_t name_length;
+  const char *name = ts_query_string_value_for_id(query, steps[0].value_id, &name_length);
+  memset(predicate, 0, sizeof(TSElPredicate));
+  const char *base = name;
+  if(strncmp(name, "not-", 4) == 0) {
+    predicate->negate = true;
+    base = name + 4;
+  }
+  if(strcmp(base, "eq?") == 0) {
+    predicate->type = TSEL_PREDICATE_EQ;
+  }
+  else if(strcmp(base, "match?") == 0) {
+    predicate->type = TSEL_PREDICATE_MATCH;
+  }
+  else if(strcmp(base, "any-of?") == 0) {
+    predicate->type = TSEL_PREDICATE_ANY_OF;
+  }
+  else {
+    // Left to the caller, like #set! and #is?
+    return 0;
+  }
+  if(count < 3 || steps[1].type != TSQueryPredicateStepTypeCapture ||
+     (predicate->type != TSEL_PREDICATE_ANY_OF && count != 3)) {
+    snprintf(error, error_size, "Wrong arguments to #%s", name);
+    return -1;
+  }
+  predicate->capture = steps[1].value_id;
+  if(predicate->type == TSEL_PREDICATE_EQ && steps[2].type == TSQueryPredicateStepTypeCapture) {
+    predicate->other_is_capture = true;
+    predicate->other_capture = steps[2].value_id;
+    return 1;
+  }
+  for(uint32_t i = 2; i < count; i++) {
+    if(steps[i].type != TSQueryPredicateStepTypeString) {
+      snprintf(error, error_size, "Wrong arguments to #%s", name);
+      tsel_predicate_free(predicate);
+      return -1;
+    }
+    if(!tsel_predicate_add_string(query, predicate, steps[i].value_id)) {
+      snprintf(error, error_size, "Allocation failed");
+      tsel_predicate_free(predicate);
+      return -1;
+    }
+  }
+  if(predicate->type == TSEL_PREDICATE_MATCH) {
+    // Strings from the query may not be terminated where regcomp expects
+    char *pattern = malloc(predicate->lengths[0] + 1);
+    if(!pattern) {
+      snprintf(error, error_size, "Allocation failed");
+      tsel_predicate_free(predicate);
+      return -1;
+    }
+    memcpy(pattern, predicate->strings[0], predicate->lengths[0]);
+    pattern[predicate->lengths[0]] = '\0';
+    int code = regcomp(&predicate->regex, pattern, REG_EXTENDED | REG_NOSUB);
+    if(code != 0) {
+      char message[128];
+      regerror(code, &predicate->regex, message, sizeof(message));
+      snprintf(error, error_size, "Invalid regexp \"%.64s\" in #%s: %s", pattern, name, message);
+      free(pattern);
+      // regcomp leaves nothing to free on failure
+      predicate->type = TSEL_PREDICATE_EQ;
+      tsel_predicate_free(predicate);
+      return -1;
+    }
+    free(pattern);
+  }
+  return 1;
+}
+
+bool tsel_predicates_parse(const TSQuery *query, TSElPredicates **predicates,
+                           char *error, size_t error_size) {
+  *predicates = NULL;
+  uint32_t pattern_count = ts_query_pattern_count(query);
+  TSElPredicates *result = malloc(sizeof(TSElPredicates));
+  if(!result) {
+    snprintf(error, error_size, "Allocation failed");
+    return false;
+  }
+  result->pattern_count = pattern_count;
+  result->patterns = calloc(pattern_count + 1, sizeof(TSElPatternPredicates));
+  if(!result->patterns) {
+    free(result);
+    snprintf(error, error_size, "Allocation failed");
+    return false;
+  }
+  bool any = false;
+  for(uint32_t pattern = 0; pattern < pattern_count; pattern++) {
+    uint32_t length;
+    const TSQueryPredicateStep *steps = ts_query_predicates_for_pattern(query, pattern, &length);
+    uint32_t start = 0;
+    for(uint32_t i = 0; i < length; i++) {
+      if(steps[i].type != TSQueryPredicateStepTypeDone) {
+        continue;
+      }
+      TSElPredicate predicate;
+      int parsed = tsel_predicate_parse(query, steps + start, i - start, &predicate,
+                                        error, error_size);
+      start = i + 1;
+      if(parsed == 0) {
+        continue;
+      }
+      TSElPatternPredicates *entry = &result->patterns[pattern];
+      TSElPredicate *grown = NULL;
+      if(parsed > 0) {
+        grown = realloc(entry->predicates, (entry->count + 1) * sizeof(TSElPredicate));
+        if(!grown) {
+          tsel_predicate_free(&predicate);
+          snprintf(error, error_size, "Allocation failed");
+        }
+      }
+      if(!grown) {
+        size_t used = strlen(error);
+        snprintf(error + used, error_size - used, " in pattern %u", pattern);
+        tsel_predicates_free(result);
+        return false;
+      }
+      entry->predicates = grown;
+      entry->predicates[entry->count++] = predicate;
+      any = true;
+    }
+  }
+  if(!any) {
+    // Nothing to check, so let callers skip predicates entirely
+    tsel_predicates_free(result);
+    return true;
+  }
+  *predicates = result;
+  return true;
+}
+
+void tsel_predicates_free(TSElPredicates *predicates) {
+  if(!predicates) {
+    return;
+  }
+  for(uint32_t i = 0; i < predicates->pattern_count; i++) {
+    for(uint32_t j = 0; j < predicates->patterns[i].count; j++) {
+      tsel_predicate_free(&predicates->patterns[i].predicates[j]);
+    }
+    free(predicates->patterns[i].predicates);
+  }
+  free(predicates->patterns);
+  free(predicates);
+}
+
+void tsel_text_source_init_buffer(TSElTextSource *source, emacs_env *env, emacs_value buffer) {
+  memset(source, 0, sizeof(TSElTextSource));
+  source->env = env;
+  source->buffer = buffer;
+}
+
+void tsel_text_source_init_text(TSElTextSource *source, const char *text, size_t length) {
+  memset(source, 0, sizeof(TSElTextSource));
+  source->text = text;
+  source->length = length;
+}
+
+void tsel_text_source_free(TSElTextSource *source) {
+  free(source->owned);
+  source->owned = NULL;
+  free(source->scratch[0]);
+  free(source->scratch[1]);
+  source->scratch[0] = NULL;
+  source->scratch[1] = NULL;
+}
+
+// Get the text of NODE into scratch SLOT, NUL terminated
+static bool tsel_text_source_get(TSElTextSource *source, TSNode node, int slot,
+                                 const char **text, size_t *length) {
+  if(!source->text) {
+    // One copy of the buffer serves every node checked in this call
+    if(!source->env || !tsel_copy_text(source->env, source->buffer, &source->owned,
+                                       &source->length)) {
+      return false;
+    }
+    source->text = source->owned;
+  }
+  size_t start = ts_node_start_byte(node), end = ts_node_end_byte(node);
+  if(end > source->length) {
+    end = source->length;
+  }
+  if(start > end) {
+    start = end;
+  }
+  size_t size = end - start;
+  if(source->scratch_size[slot] < size + 1) {
+    char *grown = realloc(source->scratch[slot], size + 1);
+    if(!grown) {
+      return false;
+    }
+    source->scratch[slot] = grown;
+    source->scratch_size[slot] = size + 1;
+  }
+  memcpy(source->scratch[slot], source->text + start, size);
+  source->scratch[slot][size] = '\0';
+  *text = source->scratch[slot];
+  *length = size;
+  return true;
+}
+
+static bool tsel_match_capture(const TSQueryMatch *match, uint32_t capture, TSNode *node) {
+  for(uint16_t i = 0; i < match->capture_count; i++) {
+    if(match->captures[i].index == capture) {
+      *node = match->captures[i].node;
+      return true;
+    }
+  }
+  return false;
+}
+
+static int tsel_predicate_check_node(const TSElPredicate *predicate, const TSQueryMatch *match,
+                                     TSNode node, TSElTextSource *source) {
+  const char *text;
+  size_t length;
+  if(!tsel_text_source_get(source, node, 0, &text, &length)) {
+    return -1;
+  }
+  bool result = false;
+  switch(predicate->type) {
+  case TSEL_PREDICATE_EQ:
+    if(predicate->other_is_capture) {
+      TSNode other;
+      if(!tsel_match_capture(match, predicate->other_capture, &other)) {
+        return 1;
+      }
+      const char *other_text;
+      size_t other_length;
+      if(!tsel_text_source_get(source, other, 1, &other_text, &other_length)) {
+        return -1;
+      }
+      result = length == other_length && memcmp(text, other_text, length) == 0;
+    }
+    else {
+      result = length == predicate->lengths[0] && memcmp(text, predicate->strings[0], length) == 0;
+    }
+    break;
+  case TSEL_PREDICATE_MATCH:
+#ifdef REG_STARTEND
+    {
+      // Match the whole text, past any NUL bytes in it
+      regmatch_t bounds = { .rm_so = 0, .rm_eo = length };
+      result = regexec(&predicate->regex, text, 1, &bounds, REG_STARTEND) == 0;
+    }
+#else
+    result = regexec(&predicate->regex, text, 0, NULL, 0) == 0;
+#endif
+    break;
+  case TSEL_PREDICATE_ANY_OF:
+    for(uint32_t i = 0; i < predicate->string_count && !result; i++) {
+      result = length == predicate->lengths[i] && memcmp(text, predicate->strings[i], length) == 0;
+    }
+    break;
+  }
+  return result != predicate->negate;
+}
+
+int tsel_predicates_check(const TSElPredicates *predicates, const TSQueryMatch *match,
+                          TSElTextSource *source) {
+  // Returns 1 if MATCH passes, 0 if it fails and -1 if text could not
+  // be read. A capture missing from an in-progress match passes, as it
+  // cannot be judged yet.
+  if(!predicates || match->pattern_index >= predicates->pattern_count) {
+    return 1;
+  }
+  const TSElPatternPredicates *pattern = &predicates->patterns[match->pattern_index];
+  if(pattern->count == 0) {
+    return 1;
+  }
+  // Failed matches are removed, so only passes come back. An
+  // in-progress match is judged again once it gains captures.
+  TSElPassedMatch *cached = &source->passed[match->id % TSEL_PASSED_MATCHES];
+  TSNode first = match->capture_count > 0 ? match->captures[0].node : (TSNode){ 0 };
+  if(cached->predicates == predicates && cached->id == match->id &&
+     cached->pattern == match->pattern_index &&
+     cached->capture_count == match->capture_count &&
+     cached->node == first.id && cached->tree == first.tree) {
+    return 1;
+  }
+  for(uint32_t i = 0; i < pattern->count; i++) {
+    const TSElPredicate *predicate = &pattern->predicates[i];
+    for(uint16_t j = 0; j < match->capture_count; j++) {
+      if(match->captures[j].index != predicate->capture) {
+        continue;
+      }
+      int result = tsel_predicate_check_node(predicate, match, match->captures[j].node, source);
+      if(result != 1) {
+        return result;
+      }
+    }
+  }
+  cached->predicates = predicates;
+  cached->id = match->id;
+  cached->pattern = match->pattern_index;
+  cached->capture_count = match->capture_count;
+  cached->node = first.id;
+  cached->tree = first.tree;
+  return 1;
+}
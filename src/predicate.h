@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2019 Karl Otness
+ *
+ * This file is part of tree-sitter.el.
+ *
+ * tree-sitter.el is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * tree-sitter.el is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tree-sitter.el. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#ifndef TSEL_PREDICATE_H
+#define TSEL_PREDICATE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <regex.h>
+#include <emacs-module.h>
+#include "tree_sitter/api.h"
+
+typedef enum TSElPredicateType {
+  TSEL_PREDICATE_EQ,
+  TSEL_PREDICATE_MATCH,
+  TSEL_PREDICATE_ANY_OF,
+} TSElPredicateType;
+
+typedef struct TSElPredicate {
+  TSElPredicateType type;
+  bool negate;
+  uint32_t capture;
+  // #eq? compares against another capture or a string
+  bool other_is_capture;
+  uint32_t other_capture;
+  // Strings for #eq? (one) and #any-of? (several)
+  const char **strings;
+  uint32_t *lengths;
+  uint32_t string_count;
+  regex_t regex;
+} TSElPredicate;
+
+typedef struct TSElPatternPredicates {
+  TSElPredicate *predicates;
+  uint32_t count;
+} TSElPatternPredicates;
+
+typedef struct TSElPredicates {
+  uint32_t pattern_count;
+  TSElPatternPredicates *patterns;
+} TSElPredicates;
+
+// A match recently found to pass its predicates. NODE and TREE name
+// its first captured node, which tells apart matches reusing an id.
+typedef struct TSElPassedMatch {
+  const TSElPredicates *predicates;
+  uint32_t id;
+  uint16_t pattern;
+  uint16_t capture_count;
+  const void *node;
+  const void *tree;
+} TSElPassedMatch;
+
+#define TSEL_PASSED_MATCHES 8
+
+// Where predicates read capture text from. Either TEXT holds the
+// whole source, or it is copied from BUFFER through ENV into OWNED the
+// first time a predicate needs text, so each node is then read
+// without calling into Lisp. PASSED remembers recent verdicts so a
+// match is judged once rather than once per capture.
+typedef struct TSElTextSource {
+  emacs_env *env;
+  emacs_value buffer;
+  const char *text;
+  size_t length;
+  char *owned;
+  char *scratch[2];
+  size_t scratch_size[2];
+  TSElPassedMatch passed[TSEL_PASSED_MATCHES];
+} TSElTextSource;
+
+bool tsel_predicates_parse(const TSQuery *query, TSElPredicates **predicates,
+                           char *error, size_t error_size);
+void tsel_predicates_free(TSElPredicates *predicates);
+int tsel_predicates_check(const TSElPredicates *predicates, const TSQueryMatch *match,
+                          TSElTextSource *source);
+void tsel_text_source_init_buffer(TSElTextSource *source, emacs_env *env, emacs_value buffer);
+void tsel_text_source_init_text(TSElTextSource *source, const char *text, size_t length);
+void tsel_text_source_free(TSElTextSource *source);
+
+#endif //ifndef TSEL_PREDICATE_H
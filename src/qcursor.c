@@ -25,13 +25,174 @@
 #include "point.h"
 #include <emacs-module.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void tsel_qcursor_profile_free(TSElQueryProfile *profile) {
+  if(profile) {
+    free(profile->patterns);
+    free(profile->seen);
+    free(profile);
+  }
+}
 
 static void tsel_qcursor_fin(void *ptr) {
   TSElQueryCursor *cursor = ptr;
+  tsel_qcursor_profile_free(cursor->profile);
   ts_query_cursor_delete(cursor->cursor);
+  tsel_tree_release(cursor->tree);
+  tsel_query_release(cursor->query);
   free(cursor);
 }
 
+static bool tsel_qcursor_executed(emacs_env *env, TSElQueryCursor *qcursor) {
+  if(!qcursor->query) {
+    tsel_signal_error(env, "Query cursor has not been executed.");
+    return false;
+  }
+  return true;
+}
+
+static bool tsel_qcursor_profile_start(TSElQueryProfile *profile, TSElQuery *query) {
+  // Stats add up over every exec of the same query, and start over
+  // when the cursor moves to another one
+  if(profile->query == query) {
+    return true;
+  }
+  uint32_t count = query ? ts_query_pattern_count(query->query) : 0;
+  TSElPatternStats *patterns = calloc(count + 1, sizeof(TSElPatternStats));
+  if(!patterns) {
+    return false;
+  }
+  free(profile->patterns);
+  profile->patterns = patterns;
+  profile->query = query;
+  return true;
+}
+
+static TSElSeenMatch *tsel_qcursor_profile_slot(TSElSeenMatch *seen, uint32_t capacity,
+                                                uint32_t id) {
+  // Linear probing in a table whose capacity is a power of two
+  uint32_t i = (id * 2654435761u) & (capacity - 1);
+  while(seen[i].used && seen[i].id != id) {
+    i = (i + 1) & (capacity - 1);
+  }
+  return &seen[i];
+}
+
+static bool tsel_qcursor_profile_grow(TSElQueryProfile *profile) {
+  uint32_t capacity = profile->seen_capacity ? profile->seen_capacity * 2 : 64;
+  TSElSeenMatch *seen = calloc(capacity, sizeof(TSElSeenMatch));
+  if(!seen) {
+    return false;
+  }
+  for(uint32_t i = 0; i < profile->seen_capacity; i++) {
+    if(profile->seen[i].used) {
+      *tsel_qcursor_profile_slot(seen, capacity, profile->seen[i].id) = profile->seen[i];
+    }
+  }
+  free(profile->seen);
+  profile->seen = seen;
+  profile->seen_capacity = capacity;
+  return true;
+}
+
+static bool tsel_qcursor_profile_capture(TSElQueryProfile *profile, const TSQueryMatch *match) {
+  // Returns true the first time a capture of MATCH comes back. Matches
+  // are not forgotten when some number of captures has been returned,
+  // since captures outside the byte range of the cursor never are, and
+  // a match still being found reports fewer captures than it ends with.
+  if(profile->seen_count * 2 >= profile->seen_capacity && !tsel_qcursor_profile_grow(profile)) {
+    // Counting may then repeat for this match, which only skews stats
+    return true;
+  }
+  TSElSeenMatch *slot = tsel_qcursor_profile_slot(profile->seen, profile->seen_capacity, match->id);
+  const void *node = match->captures[0].node.id;
+  if(slot->used && slot->pattern == match->pattern_index && slot->node == node) {
+    return false;
+  }
+  if(!slot->used) {
+    profile->seen_count++;
+  }
+  slot->id = match->id;
+  slot->pattern = match->pattern_index;
+  slot->node = node;
+  slot->used = true;
+  return true;
+}
+
+static void tsel_qcursor_profile_forget(TSElQueryProfile *profile, uint32_t id) {
+  // The slot stays in use so probing past it still works, but no match
+  // has a NULL first node, so the id counts again if it comes back
+  if(profile->seen_capacity == 0) {
+    return;
+  }
+  TSElSeenMatch *slot = tsel_qcursor_profile_slot(profile->seen, profile->seen_capacity, id);
+  if(slot->used) {
+    slot->node = NULL;
+  }
+}
+
+static void tsel_qcursor_profile_reset(TSElQueryProfile *profile) {
+  if(profile->seen_capacity > 0) {
+    memset(profile->seen, 0, profile->seen_capacity * sizeof(TSElSeenMatch));
+  }
+  profile->seen_count = 0;
+}
+
+static bool tsel_qcursor_profiled_next(TSElQueryCursor *qcursor, TSElTextSource *source,
+                                       TSQueryMatch *match, uint32_t *index) {
+  // Tree-sitter advances all patterns together, so each step is
+  // charged to the pattern whose capture it produced
+  TSElQueryProfile *profile = qcursor->profile;
+  if(!profile) {
+    return tsel_qcursor_next_raw(qcursor->cursor, qcursor->query->predicates,
+                                 source, match, index);
+  }
+  while(true) {
+    double start = tsel_now();
+    if(!ts_query_cursor_next_capture(qcursor->cursor, match, index)) {
+      return false;
+    }
+    int passed = tsel_predicates_check(qcursor->query->predicates, match, source);
+    TSElPatternStats *stats = &profile->patterns[match->pattern_index];
+    stats->seconds += tsel_now() - start;
+    if(passed > 0) {
+      stats->matches += tsel_qcursor_profile_capture(profile, match);
+      stats->captures++;
+      return true;
+    }
+    if(passed < 0) {
+      return false;
+    }
+    stats->removed++;
+    tsel_qcursor_profile_forget(profile, match->id);
+    ts_query_cursor_remove_match(qcursor->cursor, match->id);
+  }
+}
+
+static bool tsel_qcursor_profiled_next_match(TSElQueryCursor *qcursor, TSElTextSource *source,
+                                             TSQueryMatch *match) {
+  TSElQueryProfile *profile = qcursor->profile;
+  while(true) {
+    double start = profile ? tsel_now() : 0;
+    if(!ts_query_cursor_next_match(qcursor->cursor, match)) {
+      return false;
+    }
+    int passed = tsel_predicates_check(qcursor->query->predicates, match, source);
+    if(profile) {
+      TSElPatternStats *stats = &profile->patterns[match->pattern_index];
+      stats->seconds += tsel_now() - start;
+      stats->matches += passed > 0;
+      stats->captures += passed > 0 ? match->capture_count : 0;
+      stats->removed += passed == 0;
+    }
+    if(passed != 0) {
+      return passed > 0;
+    }
+  }
+}
+
 static const char *tsel_query_cursor_new_doc =
   "Create a new cursor for executing a given query\n"
   "\n"
@@ -40,7 +201,7 @@ static emacs_value tsel_query_cursor_new(emacs_env *env,
 					 __attribute__((unused)) ptrdiff_t nargs,
 					 __attribute__((unused)) emacs_value *args,
 					 __attribute__((unused)) void *data) {
-  TSElQueryCursor *wrapper = malloc(sizeof(TSElQuery));
+  TSElQueryCursor *wrapper = malloc(sizeof(TSElQueryCursor));
   TSQueryCursor* qcursor = ts_query_cursor_new();
   if (!wrapper || !qcursor) {
     if (wrapper) {
@@ -54,6 +215,9 @@ static emacs_value tsel_query_cursor_new(emacs_env *env,
     return tsel_Qnil;
   }
   wrapper->cursor = qcursor;
+  wrapper->tree = NULL;
+  wrapper->query = NULL;
+  wrapper->profile = NULL;
   emacs_value new_querycursor = env->make_user_ptr(env, &tsel_qcursor_fin, wrapper);
   emacs_value Qts_query_cursor_create = env->intern(env, "tree-sitter-query-cursor--create");
   emacs_value funargs[1] = {new_querycursor};
@@ -81,27 +245,47 @@ static emacs_value tsel_query_cursor_exec(emacs_env *env,
   TSEL_SUBR_EXTRACT(qcursor,env,args[0],&qcursor);
   TSEL_SUBR_EXTRACT(query,env,args[1],&query);
   TSEL_SUBR_EXTRACT(node,env,args[2],&node);
-  qcursor->node = node;
+  if(qcursor->profile && !tsel_qcursor_profile_start(qcursor->profile, query)) {
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  if(qcursor->profile) {
+    tsel_qcursor_profile_reset(qcursor->profile);
+  }
+  tsel_tree_retain(node->tree);
+  tsel_query_retain(query);
+  tsel_tree_release(qcursor->tree);
+  tsel_query_release(qcursor->query);
+  qcursor->tree = node->tree;
+  qcursor->query = query;
   ts_query_cursor_exec(qcursor->cursor,query->query,node->node);
   return tsel_Qnil;
 }
 
 static const char *tsel_query_cursor_next_capture_doc = "Advance to the next capture of the currently running query.\n"
+  "Text predicates in the query are checked against BUFFER, which defaults\n"
+  "to the current buffer.\n"
   "\n"
-  "(fn QCURSOR)";
+  "(fn QCURSOR &optional BUFFER)";
 static emacs_value tsel_query_cursor_next_capture(emacs_env *env,
-						  __attribute__((unused)) ptrdiff_t nargs,
+						  ptrdiff_t nargs,
 						  emacs_value *args,
 						  __attribute__((unused)) void *data) {
   TSElQueryCursor* qcursor;
   TSEL_SUBR_EXTRACT(qcursor,env,args[0],&qcursor);
+  if(!tsel_qcursor_executed(env, qcursor)) {
+    return tsel_Qnil;
+  }
+  TSElTextSource source;
+  tsel_text_source_init_buffer(&source, env, nargs > 1 ? args[1] : tsel_Qnil);
   TSQueryMatch match;
   uint32_t index;
-  bool result = ts_query_cursor_next_capture(qcursor->cursor,&match,&index);
+  bool result = tsel_qcursor_profiled_next(qcursor, &source, &match, &index);
+  tsel_text_source_free(&source);
   if(!result){
     return tsel_Qnil;
   }
-  emacs_value node = tsel_node_emacs_move(env,match.captures->node,qcursor->node->tree);
+  emacs_value node = tsel_node_emacs_move(env,match.captures[index].node,qcursor->tree);
   emacs_value func_args[] = {env->make_integer(env,match.capture_count),
     node,env->make_integer(env,match.id),env->make_integer(env,match.pattern_index)};
   
@@ -109,21 +293,29 @@ static emacs_value tsel_query_cursor_next_capture(emacs_env *env,
   return env->funcall(env,Qtree_sitter_query_match_create,4,func_args);
 }
 
-static const char *tsel_query_cursor_next_match_doc = "Get the number of string literals in the query.\n"
+static const char *tsel_query_cursor_next_match_doc = "Advance to the next match of the currently running query.\n"
+  "Text predicates in the query are checked against BUFFER, which defaults\n"
+  "to the current buffer.\n"
   "\n"
-  "(fn QCURSOR)";
+  "(fn QCURSOR &optional BUFFER)";
 static emacs_value tsel_query_cursor_next_match(emacs_env *env,
-						__attribute__((unused)) ptrdiff_t nargs,
+						ptrdiff_t nargs,
 						emacs_value *args,
 						__attribute__((unused)) void *data) {
   TSElQueryCursor* qcursor;
   TSEL_SUBR_EXTRACT(qcursor,env,args[0],&qcursor);
+  if(!tsel_qcursor_executed(env, qcursor)) {
+    return tsel_Qnil;
+  }
+  TSElTextSource source;
+  tsel_text_source_init_buffer(&source, env, nargs > 1 ? args[1] : tsel_Qnil);
   TSQueryMatch match;
-  bool result = ts_query_cursor_next_match(qcursor->cursor,&match);
+  bool result = tsel_qcursor_profiled_next_match(qcursor, &source, &match);
+  tsel_text_source_free(&source);
   if(!result){
     return tsel_Qnil;
   }
-  emacs_value node = tsel_node_emacs_move(env,match.captures->node,qcursor->node->tree);
+  emacs_value node = tsel_node_emacs_move(env,match.captures->node,qcursor->tree);
   emacs_value func_args[] = {env->make_integer(env,match.capture_count),
     node,env->make_integer(env,match.id),env->make_integer(env,match.pattern_index)};
   
@@ -142,6 +334,9 @@ static emacs_value tsel_query_cursor_remove_match(emacs_env *env,
   intmax_t id;
   TSEL_SUBR_EXTRACT(qcursor,env,args[0],&qcursor);
   TSEL_SUBR_EXTRACT(integer,env,args[1],&id);
+  if(qcursor->profile) {
+    tsel_qcursor_profile_forget(qcursor->profile, id);
+  }
   ts_query_cursor_remove_match(qcursor->cursor,id);
   return tsel_Qnil;
 }
@@ -173,11 +368,441 @@ static emacs_value tsel_query_cursor_set_point_range(emacs_env *env,
   TSPoint pt1,pt2;
   TSEL_SUBR_EXTRACT(qcursor,env,args[0],&qcursor);
   TSEL_SUBR_EXTRACT(point,env,args[1],&pt1);
-  TSEL_SUBR_EXTRACT(point,env,args[1],&pt2);
+  TSEL_SUBR_EXTRACT(point,env,args[2],&pt2);
   ts_query_cursor_set_point_range(qcursor->cursor,pt1,pt2);
   return tsel_Qnil;
 }
 
+static const char *tsel_query_cursor_set_profiling_doc = "Turn profiling of QCURSOR on if FLAG is non-nil, or off.\n"
+  "While profiling, QCURSOR counts the matches, captures and matches\n"
+  "removed by text predicates of each pattern, and the time spent on each,\n"
+  "for `tree-sitter-query-profile'. The counts add up over every run of\n"
+  "the same query and start over when QCURSOR runs another query. Turning\n"
+  "profiling off discards them.\n"
+  "\n"
+  "(fn QCURSOR FLAG)";
+static emacs_value tsel_query_cursor_set_profiling(emacs_env *env,
+                                                   __attribute__((unused)) ptrdiff_t nargs,
+                                                   emacs_value *args,
+                                                   __attribute__((unused)) void *data) {
+  TSElQueryCursor *qcursor;
+  TSEL_SUBR_EXTRACT(qcursor, env, args[0], &qcursor);
+  if(!env->is_not_nil(env, args[1])) {
+    tsel_qcursor_profile_free(qcursor->profile);
+    qcursor->profile = NULL;
+    return tsel_Qnil;
+  }
+  if(qcursor->profile) {
+    return tsel_Qnil;
+  }
+  TSElQueryProfile *profile = calloc(1, sizeof(TSElQueryProfile));
+  if(!profile || !tsel_qcursor_profile_start(profile, qcursor->query)) {
+    free(profile);
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  qcursor->profile = profile;
+  return tsel_Qnil;
+}
+
+typedef struct tsel_pattern_cost {
+  uint32_t pattern;
+  const TSElPatternStats *stats;
+} tsel_pattern_cost;
+
+static int tsel_pattern_cost_compare(const void *a, const void *b) {
+  // Most time first, then most captures, then source order
+  const tsel_pattern_cost *ca = a, *cb = b;
+  if(ca->stats->seconds != cb->stats->seconds) {
+    return ca->stats->seconds > cb->stats->seconds ? -1 : 1;
+  }
+  if(ca->stats->captures != cb->stats->captures) {
+    return ca->stats->captures > cb->stats->captures ? -1 : 1;
+  }
+  return ca->pattern < cb->pattern ? -1 : ca->pattern > cb->pattern;
+}
+
+static const char *tsel_query_profile_doc = "Return the profile QCURSOR recorded for its query, costliest first.\n"
+  "Each element is a vector [PATTERN START MATCHES CAPTURES REMOVED SECONDS]\n"
+  "for one pattern which did any work. PATTERN is the pattern index and\n"
+  "START the byte where it starts in the query source, as returned by\n"
+  "`tree-sitter-query-start-byte-for-pattern'. MATCHES and CAPTURES count\n"
+  "what it produced, REMOVED the matches its text predicates rejected,\n"
+  "and SECONDS the time spent finding and checking them. Tree-sitter\n"
+  "advances all patterns at once, so the time of each step goes to the\n"
+  "pattern it produced a result for.\n"
+  "Returns nil unless profiling was turned on with\n"
+  "`tree-sitter-query-cursor-set-profiling'.\n"
+  "\n"
+  "(fn QCURSOR)";
+static emacs_value tsel_query_profile(emacs_env *env,
+                                      __attribute__((unused)) ptrdiff_t nargs,
+                                      emacs_value *args,
+                                      __attribute__((unused)) void *data) {
+  TSElQueryCursor *qcursor;
+  TSEL_SUBR_EXTRACT(qcursor, env, args[0], &qcursor);
+  TSElQueryProfile *profile = qcursor->profile;
+  if(!profile || !profile->query) {
+    return tsel_Qnil;
+  }
+  uint32_t count = ts_query_pattern_count(profile->query->query);
+  tsel_pattern_cost *costs = malloc((count + 1) * sizeof(tsel_pattern_cost));
+  if(!costs) {
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  uint32_t used = 0;
+  for(uint32_t i = 0; i < count; i++) {
+    const TSElPatternStats *stats = &profile->patterns[i];
+    if(stats->matches || stats->removed || stats->seconds > 0) {
+      costs[used].pattern = i;
+      costs[used].stats = stats;
+      used++;
+    }
+  }
+  qsort(costs, used, sizeof(tsel_pattern_cost), &tsel_pattern_cost_compare);
+  emacs_value Qcons = env->intern(env, "cons");
+  emacs_value result = tsel_Qnil;
+  for(uint32_t i = used; i > 0 && !tsel_pending_nonlocal_exit(env); i--) {
+    const tsel_pattern_cost *cost = &costs[i - 1];
+    uint32_t start = ts_query_start_byte_for_pattern(profile->query->query, cost->pattern);
+    emacs_value row = tsel_make_vector(env, 6, tsel_Qnil);
+    env->vec_set(env, row, 0, env->make_integer(env, cost->pattern));
+    env->vec_set(env, row, 1, env->make_integer(env, (intmax_t) start + 1));
+    env->vec_set(env, row, 2, env->make_integer(env, cost->stats->matches));
+    env->vec_set(env, row, 3, env->make_integer(env, cost->stats->captures));
+    env->vec_set(env, row, 4, env->make_integer(env, cost->stats->removed));
+    env->vec_set(env, row, 5, env->make_float(env, cost->stats->seconds));
+    emacs_value cell[2] = { row, result };
+    result = env->funcall(env, Qcons, 2, cell);
+  }
+  free(costs);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return result;
+}
+
+static emacs_value tsel_query_captures_collect(emacs_env *env, ptrdiff_t nargs,
+                                               emacs_value *args, bool tagged) {
+  TSElQuery *query;
+  TSElNode *node;
+  intmax_t start = 1, end = (intmax_t) UINT32_MAX + 1;
+  TSEL_SUBR_EXTRACT(query, env, args[0], &query);
+  TSEL_SUBR_EXTRACT(node, env, args[1], &node);
+  if(tagged && query->member_count == 0) {
+    tsel_signal_error(env, "Query is not a query bundle.");
+    return tsel_Qnil;
+  }
+  if(nargs > 2 && env->is_not_nil(env, args[2])) {
+    TSEL_SUBR_EXTRACT(integer, env, args[2], &start);
+  }
+  if(nargs > 3 && env->is_not_nil(env, args[3])) {
+    TSEL_SUBR_EXTRACT(integer, env, args[3], &end);
+  }
+  TSQueryCursor *cursor = tsel_query_cursor_take(query);
+  if(!cursor) {
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  ts_query_cursor_set_byte_range(cursor, start - 1, end - 1);
+  ts_query_cursor_exec(cursor, query->query, node->node);
+  TSElTextSource source;
+  tsel_text_source_init_buffer(&source, env, nargs > 4 ? args[4] : tsel_Qnil);
+  // Collect first so the vector can be made at its final size
+  TSElCaptureList list = {0};
+  TSElCapture capture;
+  bool ok = true;
+  while(ok && tsel_qcursor_next(cursor, query->predicates, &source, &capture)) {
+    ok = tsel_capture_list_push(&list, &capture);
+  }
+  TSElCapture *captures = list.items;
+  size_t count = list.count;
+  tsel_query_cursor_return(query, cursor);
+  tsel_text_source_free(&source);
+  if(!ok || tsel_pending_nonlocal_exit(env)) {
+    free(captures);
+    if(tsel_pending_nonlocal_exit(env)) {
+      return tsel_Qnil;
+    }
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  ptrdiff_t width = tagged ? TSEL_CAPTURE_ENTRY_SIZE + 1 : TSEL_CAPTURE_ENTRY_SIZE;
+  emacs_value result = tsel_make_vector(env, count * width, tsel_Qnil);
+  for(size_t i = 0; i < count && !tsel_pending_nonlocal_exit(env); i++) {
+    ptrdiff_t offset = i * width;
+    if(tagged) {
+      env->vec_set(env, result, offset++,
+                   query->member_names[query->pattern_members[captures[i].pattern]]);
+    }
+    tsel_qcursor_capture_entry(env, result, offset, query, &captures[i], node->tree);
+  }
+  free(captures);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return result;
+}
+
+static const char *tsel_query_captures_doc = "Run QUERY on NODE and return every capture in one vector.\n"
+  "START and END optionally limit the search to a range of bytes.\n"
+  "The vector holds four elements per capture, in the order the captures\n"
+  "appear in the tree: the capture name as an interned symbol, the\n"
+  "captured node, and its start and end bytes.\n"
+  "Text predicates in QUERY are checked against BUFFER, which defaults to\n"
+  "the current buffer.\n"
+  "\n"
+  "(fn QUERY NODE &optional START END BUFFER)";
+static emacs_value tsel_query_captures(emacs_env *env,
+                                       ptrdiff_t nargs,
+                                       emacs_value *args,
+                                       __attribute__((unused)) void *data) {
+  return tsel_query_captures_collect(env, nargs, args, false);
+}
+
+static const char *tsel_query_bundle_captures_doc = "Run query bundle QUERY on NODE and return every capture in one vector.\n"
+  "This is `tree-sitter-query-captures' with a fifth element leading each\n"
+  "capture: the name of the bundle member whose pattern made it, as given\n"
+  "to `tree-sitter-query-bundle-new'.\n"
+  "\n"
+  "(fn QUERY NODE &optional START END BUFFER)";
+static emacs_value tsel_query_bundle_captures(emacs_env *env,
+                                              ptrdiff_t nargs,
+                                              emacs_value *args,
+                                              __attribute__((unused)) void *data) {
+  return tsel_query_captures_collect(env, nargs, args, true);
+}
+
+int tsel_byte_range_compare(const void *a, const void *b) {
+  const TSElByteRange *ra = a, *rb = b;
+  if(ra->start != rb->start) {
+    return ra->start < rb->start ? -1 : 1;
+  }
+  return ra->end < rb->end ? -1 : ra->end > rb->end;
+}
+
+static bool tsel_query_extract_ranges(emacs_env *env, emacs_value vector,
+                                      TSElByteRange **ranges, size_t *count) {
+  ptrdiff_t size = env->vec_size(env, vector);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return false;
+  }
+  if(size % 2 != 0) {
+    tsel_signal_error(env, "Ranges need a start and an end byte each.");
+    return false;
+  }
+  TSElByteRange *items = malloc((size / 2 + 1) * sizeof(TSElByteRange));
+  if(!items) {
+    tsel_signal_error(env, "Allocation failed.");
+    return false;
+  }
+  for(ptrdiff_t i = 0; i < size / 2; i++) {
+    intmax_t start, end;
+    if(!tsel_extract_integer(env, env->vec_get(env, vector, 2 * i), &start) ||
+       !tsel_extract_integer(env, env->vec_get(env, vector, 2 * i + 1), &end)) {
+      free(items);
+      return false;
+    }
+    if(start < 1 || end < start || end > (intmax_t) UINT32_MAX + 1) {
+      free(items);
+      tsel_signal_error(env, "Byte range out of range.");
+      return false;
+    }
+    items[i].start = start - 1;
+    items[i].end = end - 1;
+  }
+  // Sort and join ranges that touch, so each part of the tree is
+  // searched once
+  qsort(items, size / 2, sizeof(TSElByteRange), &tsel_byte_range_compare);
+  size_t merged = 0;
+  for(ptrdiff_t i = 0; i < size / 2; i++) {
+    if(merged > 0 && items[i].start <= items[merged - 1].end) {
+      if(items[i].end > items[merged - 1].end) {
+        items[merged - 1].end = items[i].end;
+      }
+    }
+    else {
+      items[merged++] = items[i];
+    }
+  }
+  *ranges = items;
+  *count = merged;
+  return true;
+}
+
+static const char *tsel_query_captures_ranges_doc = "Run QUERY on NODE within each range of bytes in RANGES.\n"
+  "RANGES is a vector holding a start and an end byte for each range, such\n"
+  "as the regions shown in several windows. Overlapping ranges are joined.\n"
+  "The result is laid out as for `tree-sitter-query-captures'. A capture\n"
+  "overlapping several ranges appears once, and captures come in the order\n"
+  "they appear in the tree.\n"
+  "Cursors are taken from a small pool kept with QUERY, so calling this\n"
+  "often, as jit-lock does, allocates no new cursors.\n"
+  "Text predicates in QUERY are checked against BUFFER, which defaults to\n"
+  "the current buffer.\n"
+  "\n"
+  "(fn QUERY NODE RANGES &optional BUFFER)";
+static emacs_value tsel_query_captures_ranges(emacs_env *env,
+                                              ptrdiff_t nargs,
+                                              emacs_value *args,
+                                              __attribute__((unused)) void *data) {
+  TSElQuery *query;
+  TSElNode *node;
+  TSElByteRange *ranges;
+  size_t range_count;
+  TSEL_SUBR_EXTRACT(query, env, args[0], &query);
+  TSEL_SUBR_EXTRACT(node, env, args[1], &node);
+  if(!tsel_query_extract_ranges(env, args[2], &ranges, &range_count)) {
+    return tsel_Qnil;
+  }
+  TSQueryCursor *cursor = tsel_query_cursor_take(query);
+  if(!cursor) {
+    free(ranges);
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  TSElTextSource source;
+  tsel_text_source_init_buffer(&source, env, nargs > 3 ? args[3] : tsel_Qnil);
+  TSElCaptureList list = {0};
+  bool ok = true;
+  for(size_t i = 0; ok && i < range_count; i++) {
+    ts_query_cursor_set_byte_range(cursor, ranges[i].start, ranges[i].end);
+    ts_query_cursor_exec(cursor, query->query, node->node);
+    TSElCapture capture;
+    while(ok && tsel_qcursor_next(cursor, query->predicates, &source, &capture)) {
+      // A capture belongs to the first range it overlaps. Those owned
+      // by later ranges start after this one ends, so the list stays in
+      // tree order.
+      size_t owner = tsel_byte_range_owner(ranges, range_count,
+                                           ts_node_start_byte(capture.node),
+                                           ts_node_end_byte(capture.node));
+      if(owner == i) {
+        ok = tsel_capture_list_push(&list, &capture);
+      }
+    }
+    ok = ok && !tsel_pending_nonlocal_exit(env);
+  }
+  tsel_query_cursor_return(query, cursor);
+  tsel_text_source_free(&source);
+  free(ranges);
+  if(!ok) {
+    free(list.items);
+    if(!tsel_pending_nonlocal_exit(env)) {
+      tsel_signal_error(env, "Allocation failed.");
+    }
+    return tsel_Qnil;
+  }
+  emacs_value result = tsel_make_vector(env, list.count * TSEL_CAPTURE_ENTRY_SIZE, tsel_Qnil);
+  for(size_t i = 0; i < list.count && !tsel_pending_nonlocal_exit(env); i++) {
+    tsel_qcursor_capture_entry(env, result, i * TSEL_CAPTURE_ENTRY_SIZE,
+                               query, &list.items[i], node->tree);
+  }
+  free(list.items);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return result;
+}
+
+static const char *tsel_query_cursor_captures_doc = "Fetch the next captures of the query running in QCURSOR into VECTOR.\n"
+  "VECTOR is filled from the start with four elements per capture, as for\n"
+  "`tree-sitter-query-captures', until it is full or the query is done.\n"
+  "Returns the number of captures stored, which is 0 once the query is\n"
+  "done. Elements past the last capture stored are left unchanged.\n"
+  "Calling this again resumes where the previous call stopped, so the same\n"
+  "vector can be reused to page through a large result.\n"
+  "Text predicates in the query are checked against BUFFER, which defaults\n"
+  "to the current buffer.\n"
+  "\n"
+  "(fn QCURSOR VECTOR &optional BUFFER)";
+static emacs_value tsel_query_cursor_captures(emacs_env *env,
+                                              ptrdiff_t nargs,
+                                              emacs_value *args,
+                                              __attribute__((unused)) void *data) {
+  TSElQueryCursor *qcursor;
+  TSEL_SUBR_EXTRACT(qcursor, env, args[0], &qcursor);
+  ptrdiff_t limit = env->vec_size(env, args[1]) / TSEL_CAPTURE_ENTRY_SIZE;
+  if(tsel_pending_nonlocal_exit(env) || !tsel_qcursor_executed(env, qcursor)) {
+    return tsel_Qnil;
+  }
+  TSElTextSource source;
+  tsel_text_source_init_buffer(&source, env, nargs > 2 ? args[2] : tsel_Qnil);
+  ptrdiff_t count = 0;
+  TSElCapture capture;
+  TSQueryMatch match;
+  uint32_t index;
+  while(count < limit && tsel_qcursor_profiled_next(qcursor, &source, &match, &index)) {
+    capture.node = match.captures[index].node;
+    capture.capture = match.captures[index].index;
+    capture.pattern = match.pattern_index;
+    tsel_qcursor_capture_entry(env, args[1], count * TSEL_CAPTURE_ENTRY_SIZE,
+                               qcursor->query, &capture, qcursor->tree);
+    count++;
+    if(tsel_pending_nonlocal_exit(env)) {
+      break;
+    }
+  }
+  tsel_text_source_free(&source);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return env->make_integer(env, count);
+}
+
+static const char *tsel_query_cursor_set_match_limit_doc = "Limit the number of in-progress matches of QCURSOR to LIMIT.\n"
+  "Patterns which could match large parts of a tree can otherwise keep a\n"
+  "great number of partial matches alive. When the limit is reached the\n"
+  "oldest matches are dropped, see\n"
+  "`tree-sitter-query-cursor-did-exceed-match-limit'.\n"
+  "\n"
+  "(fn QCURSOR LIMIT)";
+static emacs_value tsel_query_cursor_set_match_limit(emacs_env *env,
+                                                     __attribute__((unused)) ptrdiff_t nargs,
+                                                     emacs_value *args,
+                                                     __attribute__((unused)) void *data) {
+  TSElQueryCursor *qcursor;
+  intmax_t limit;
+  TSEL_SUBR_EXTRACT(qcursor, env, args[0], &qcursor);
+  TSEL_SUBR_EXTRACT(integer, env, args[1], &limit);
+  if(limit < 1 || limit > UINT32_MAX) {
+    tsel_signal_error(env, "Match limit out of range.");
+    return tsel_Qnil;
+  }
+  ts_query_cursor_set_match_limit(qcursor->cursor, limit);
+  return tsel_Qnil;
+}
+
+static const char *tsel_query_cursor_match_limit_doc = "Return the match limit of QCURSOR.\n"
+  "\n"
+  "(fn QCURSOR)";
+static emacs_value tsel_query_cursor_match_limit(emacs_env *env,
+                                                 __attribute__((unused)) ptrdiff_t nargs,
+                                                 emacs_value *args,
+                                                 __attribute__((unused)) void *data) {
+  TSElQueryCursor *qcursor;
+  TSEL_SUBR_EXTRACT(qcursor, env, args[0], &qcursor);
+  return env->make_integer(env, ts_query_cursor_match_limit(qcursor->cursor));
+}
+
+static const char *tsel_query_cursor_did_exceed_match_limit_doc = "Return t if QCURSOR dropped matches because of its match limit.\n"
+  "This refers to the query most recently started with\n"
+  "`tree-sitter-query-cursor-exec'. When it is t some captures may be\n"
+  "missing from the results.\n"
+  "\n"
+  "(fn QCURSOR)";
+static emacs_value tsel_query_cursor_did_exceed_match_limit(emacs_env *env,
+                                                            __attribute__((unused)) ptrdiff_t nargs,
+                                                            emacs_value *args,
+                                                            __attribute__((unused)) void *data) {
+  TSElQueryCursor *qcursor;
+  TSEL_SUBR_EXTRACT(qcursor, env, args[0], &qcursor);
+  if(ts_query_cursor_did_exceed_match_limit(qcursor->cursor)) {
+    return tsel_Qt;
+  }
+  return tsel_Qnil;
+}
+
 static const char *tsel_query_cursor_p_doc = "Return t if OBJECT is a tree-sitter-query-cursor.\n"
   "\n"
   "(fn QCURSOR)";
@@ -199,10 +824,10 @@ bool tsel_qcursor_init(emacs_env *env){
                                           &tsel_query_cursor_p, 1, 1,
                                           tsel_query_cursor_p_doc, NULL);
   function_result &= tsel_define_function(env, "tree-sitter-query-cursor-next-capture",
-                                          &tsel_query_cursor_next_capture, 1, 1,
+                                          &tsel_query_cursor_next_capture, 1, 2,
                                           tsel_query_cursor_next_capture_doc, NULL);
   function_result &= tsel_define_function(env, "tree-sitter-query-cursor-next-match",
-                                          &tsel_query_cursor_next_match, 1, 1,
+                                          &tsel_query_cursor_next_match, 1, 2,
                                           tsel_query_cursor_next_match_doc, NULL);
   function_result &= tsel_define_function(env, "tree-sitter-query-cursor-remove-match",
                                           &tsel_query_cursor_remove_match, 2, 2,
@@ -213,12 +838,91 @@ bool tsel_qcursor_init(emacs_env *env){
   function_result &= tsel_define_function(env, "tree-sitter-query-cursor-set-byte-range",
                                           &tsel_query_cursor_set_byte_range, 3, 3,
                                           tsel_query_cursor_set_byte_range_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-query-cursor-captures",
+                                          &tsel_query_cursor_captures, 2, 3,
+                                          tsel_query_cursor_captures_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-query-cursor-set-match-limit",
+                                          &tsel_query_cursor_set_match_limit, 2, 2,
+                                          tsel_query_cursor_set_match_limit_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-query-cursor-match-limit",
+                                          &tsel_query_cursor_match_limit, 1, 1,
+                                          tsel_query_cursor_match_limit_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-query-cursor-did-exceed-match-limit",
+                                          &tsel_query_cursor_did_exceed_match_limit, 1, 1,
+                                          tsel_query_cursor_did_exceed_match_limit_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-query-cursor-set-profiling",
+                                          &tsel_query_cursor_set_profiling, 2, 2,
+                                          tsel_query_cursor_set_profiling_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-query-profile",
+                                          &tsel_query_profile, 1, 1,
+                                          tsel_query_profile_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-query-captures",
+                                          &tsel_query_captures, 2, 5,
+                                          tsel_query_captures_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-query-bundle-captures",
+                                          &tsel_query_bundle_captures, 2, 5,
+                                          tsel_query_bundle_captures_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-query-captures-ranges",
+                                          &tsel_query_captures_ranges, 3, 4,
+                                          tsel_query_captures_ranges_doc, NULL);
   function_result &= tsel_define_function(env, "tree-sitter-query-cursor-set-point-range",
                                           &tsel_query_cursor_set_point_range, 3, 3,
                                           tsel_query_cursor_set_point_range_doc, NULL);
   return function_result;
 }
 
+bool tsel_capture_list_push(TSElCaptureList *list, const TSElCapture *capture) {
+  if(list->count == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 256;
+    TSElCapture *items = realloc(list->items, capacity * sizeof(TSElCapture));
+    if(!items) {
+      return false;
+    }
+    list->items = items;
+    list->capacity = capacity;
+  }
+  list->items[list->count++] = *capture;
+  return true;
+}
+
+bool tsel_qcursor_next_raw(TSQueryCursor *cursor, const TSElPredicates *predicates,
+                           TSElTextSource *source, TSQueryMatch *match, uint32_t *index) {
+  // Matches failing a predicate are removed so none of their other
+  // captures come back either
+  while(ts_query_cursor_next_capture(cursor, match, index)) {
+    int passed = tsel_predicates_check(predicates, match, source);
+    if(passed > 0) {
+      return true;
+    }
+    if(passed < 0) {
+      return false;
+    }
+    ts_query_cursor_remove_match(cursor, match->id);
+  }
+  return false;
+}
+
+bool tsel_qcursor_next(TSQueryCursor *cursor, const TSElPredicates *predicates,
+                       TSElTextSource *source, TSElCapture *capture) {
+  TSQueryMatch match;
+  uint32_t index;
+  if(!tsel_qcursor_next_raw(cursor, predicates, source, &match, &index)) {
+    return false;
+  }
+  capture->node = match.captures[index].node;
+  capture->capture = match.captures[index].index;
+  capture->pattern = match.pattern_index;
+  return true;
+}
+
+void tsel_qcursor_capture_entry(emacs_env *env, emacs_value vector, ptrdiff_t offset,
+                                TSElQuery *query, TSElCapture *capture, TSElTree *tree) {
+  env->vec_set(env, vector, offset, tsel_query_capture_symbol(env, query, capture->capture));
+  env->vec_set(env, vector, offset + 1, tsel_node_emacs_move(env, capture->node, tree));
+  env->vec_set(env, vector, offset + 2, env->make_integer(env, ts_node_start_byte(capture->node) + 1));
+  env->vec_set(env, vector, offset + 3, env->make_integer(env, ts_node_end_byte(capture->node) + 1));
+}
+
 bool tsel_qcursor_p(emacs_env *env, emacs_value obj){
   if(!tsel_check_record_type(env, "tree-sitter-query-cursor", obj, 1)) {
     return false;
@@ -258,3 +962,31 @@ bool tsel_extract_qcursor(emacs_env *env, emacs_value obj,TSElQueryCursor** curs
   *cursor = ptr;
   return true;
 }
+
+bool tsel_byte_range_overlaps(uint32_t start, uint32_t end, const TSElByteRange *range) {
+  if(start == end) {
+    return start >= range->start && start < range->end;
+  }
+  return start < range->end && end > range->start;
+}
+
+// Index of the first of RANGES overlapping START to END, or COUNT
+size_t tsel_byte_range_owner(const TSElByteRange *ranges, size_t count,
+                             uint32_t start, uint32_t end) {
+  // Ranges are sorted and disjoint, so only the first one ending
+  // after START can overlap
+  size_t low = 0, high = count;
+  while(low < high) {
+    size_t mid = low + (high - low) / 2;
+    if(ranges[mid].end <= start) {
+      low = mid + 1;
+    }
+    else {
+      high = mid;
+    }
+  }
+  if(low < count && tsel_byte_range_overlaps(start, end, &ranges[low])) {
+    return low;
+  }
+  return count;
+}
@@ -24,12 +24,78 @@
 #include <emacs-module.h>
 #include "tree_sitter/api.h"
 #include "node.h"
+#include "query.h"
+
+// Work done for one pattern while a query cursor was profiled
+typedef struct TSElPatternStats{
+  uint64_t matches;
+  uint64_t captures;
+  // Matches dropped because a text predicate failed
+  uint64_t removed;
+  double seconds;
+}TSElPatternStats;
+
+// A match already counted while stepping through captures. Tree-sitter
+// may give a retired match's id to a new one, so the pattern and first
+// captured node tell the two apart.
+typedef struct TSElSeenMatch{
+  uint32_t id;
+  uint32_t pattern;
+  const void* node;
+  bool used;
+}TSElSeenMatch;
+
+typedef struct TSElQueryProfile{
+  // Query the stats are for, since a cursor can run several
+  TSElQuery* query;
+  TSElPatternStats* patterns;
+  // Hash set of matches counted since the last exec, by id
+  TSElSeenMatch* seen;
+  uint32_t seen_count;
+  uint32_t seen_capacity;
+}TSElQueryProfile;
 
 typedef struct TSElQueryCursor{
   TSQueryCursor * cursor;
-  TSElNode* node;
+  // Tree and query of the last exec, retained until the next one
+  TSElTree* tree;
+  TSElQuery* query;
+  // Per-pattern stats, or NULL unless profiling
+  TSElQueryProfile* profile;
 }TSElQueryCursor;
 
+// One capture as collected from a running query
+typedef struct TSElCapture{
+  TSNode node;
+  uint32_t capture;
+  uint32_t pattern;
+}TSElCapture;
+
+typedef struct TSElCaptureList{
+  TSElCapture *items;
+  size_t count;
+  size_t capacity;
+}TSElCaptureList;
+
+// A range of bytes, with END excluded
+typedef struct TSElByteRange{
+  uint32_t start;
+  uint32_t end;
+}TSElByteRange;
+
+#define TSEL_CAPTURE_ENTRY_SIZE 4
+
+bool tsel_capture_list_push(TSElCaptureList *list, const TSElCapture *capture);
+int tsel_byte_range_compare(const void *a, const void *b);
+bool tsel_byte_range_overlaps(uint32_t start, uint32_t end, const TSElByteRange *range);
+size_t tsel_byte_range_owner(const TSElByteRange *ranges, size_t count,
+                             uint32_t start, uint32_t end);
+bool tsel_qcursor_next_raw(TSQueryCursor *cursor, const TSElPredicates *predicates,
+                           TSElTextSource *source, TSQueryMatch *match, uint32_t *index);
+bool tsel_qcursor_next(TSQueryCursor *cursor, const TSElPredicates *predicates,
+                       TSElTextSource *source, TSElCapture *capture);
+void tsel_qcursor_capture_entry(emacs_env *env, emacs_value vector, ptrdiff_t offset,
+                                TSElQuery *query, TSElCapture *capture, TSElTree *tree);
 bool tsel_qcursor_init(emacs_env *env);
 bool tsel_qcursor_p(emacs_env *env, emacs_value obj);
 bool tsel_extract_qcursor(emacs_env *env, emacs_value obj,TSElQueryCursor** cursor);
@@ -0,0 +1,733 @@
+/*
+ * Copyright (C) 2019 Karl Otness
+ *
+ * This file is part of tree-sitter.el.
+ *
+ * tree-sitter.el is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * tree-sitter.el is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tree-sitter.el. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "qresult.h"
+#include "alloc.h"
+#include "common.h"
+#include "node.h"
+
+/*
+ * Updating a result after a reparse works on regions of the new tree.
+ * The edits logged on the old tree and the changed ranges between the
+ * trees are widened to whole top-level nodes, and to the named
+ * top-level node on either side so matches between siblings are seen.
+ * Each capture records the bytes its whole match covers. Old matches
+ * touching a region are dropped, their bytes join the regions, and the
+ * query is run again there, keeping every capture of each match found.
+ * Other captures are only shifted through the logged edits, and their
+ * nodes are looked up in the new tree when next asked for. Captures
+ * are kept sorted, so the new ones are merged in, and a capture of the
+ * same node by the same pattern and capture name is kept once. When no
+ * node touching the changes has a type the query can match, there are
+ * no regions and every capture is shifted. Matches reaching further
+ * than a top-level neighbour of a change can still be missed.
+ */
+
+typedef struct tsel_range_list {
+  TSElByteRange *items;
+  size_t count;
+  size_t capacity;
+} tsel_range_list;
+
+static bool tsel_range_list_push(tsel_range_list *list, uint32_t start, uint32_t end) {
+  if(list->count == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 16;
+    TSElByteRange *items = realloc(list->items, capacity * sizeof(TSElByteRange));
+    if(!items) {
+      return false;
+    }
+    list->items = items;
+    list->capacity = capacity;
+  }
+  list->items[list->count].start = start;
+  list->items[list->count].end = end;
+  list->count++;
+  return true;
+}
+
+static void tsel_range_list_merge(tsel_range_list *list) {
+  // Sort into disjoint ranges, joining those that overlap or touch
+  qsort(list->items, list->count, sizeof(TSElByteRange), &tsel_byte_range_compare);
+  size_t merged = 0;
+  for(size_t i = 0; i < list->count; i++) {
+    if(merged > 0 && list->items[i].start <= list->items[merged - 1].end) {
+      if(list->items[i].end > list->items[merged - 1].end) {
+        list->items[merged - 1].end = list->items[i].end;
+      }
+    }
+    else {
+      list->items[merged++] = list->items[i];
+    }
+  }
+  list->count = merged;
+}
+
+static bool tsel_range_list_touches(const TSElByteRange *ranges, size_t count,
+                                    uint32_t start, uint32_t end) {
+  // Ranges are merged, so only the first one ending at or after START
+  // can touch
+  size_t low = 0, high = count;
+  while(low < high) {
+    size_t mid = low + (high - low) / 2;
+    if(ranges[mid].end < start) {
+      low = mid + 1;
+    }
+    else {
+      high = mid;
+    }
+  }
+  return low < count && ranges[low].start <= end;
+}
+
+typedef struct tsel_result_list {
+  TSElResultCapture *items;
+  size_t count;
+  size_t capacity;
+} tsel_result_list;
+
+static bool tsel_result_list_push(tsel_result_list *list, const TSElResultCapture *capture) {
+  if(list->count == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 256;
+    TSElResultCapture *items = realloc(list->items, capacity * sizeof(TSElResultCapture));
+    if(!items) {
+      return false;
+    }
+    list->items = items;
+    list->capacity = capacity;
+  }
+  list->items[list->count++] = *capture;
+  return true;
+}
+
+static int tsel_result_capture_compare(const void *a, const void *b) {
+  // Document order, with enclosing nodes before the nodes they
+  // contain. Equal captures are the same capture of the same node.
+  const TSElResultCapture *ca = a, *cb = b;
+  if(ca->start != cb->start) {
+    return ca->start < cb->start ? -1 : 1;
+  }
+  if(ca->end != cb->end) {
+    return ca->end > cb->end ? -1 : 1;
+  }
+  if(ca->pattern != cb->pattern) {
+    return ca->pattern < cb->pattern ? -1 : 1;
+  }
+  if(ca->capture != cb->capture) {
+    return ca->capture < cb->capture ? -1 : 1;
+  }
+  return ca->symbol < cb->symbol ? -1 : ca->symbol > cb->symbol;
+}
+
+static uint32_t tsel_shift_byte(uint32_t byte, const TSInputEdit *edit) {
+  if(byte >= edit->old_end_byte) {
+    return byte - edit->old_end_byte + edit->new_end_byte;
+  }
+  if(byte > edit->start_byte && byte > edit->new_end_byte) {
+    // Inside deleted text, so the capture falls in a rerun region
+    return edit->new_end_byte;
+  }
+  return byte;
+}
+
+static bool tsel_qresult_changes(TSElTree *old_tree, uint32_t edit_mark, TSElTree *new_tree,
+                                 tsel_range_list *raw) {
+  // Sorted ranges edited or changed since EDIT-MARK, in the
+  // coordinates of NEW-TREE
+  bool ok = true;
+  // Edited ranges in the coordinates of the new tree
+  for(uint32_t i = edit_mark; i < old_tree->edit_count && ok; i++) {
+    const TSInputEdit *edit = &old_tree->edits[i];
+    for(size_t j = 0; j < raw->count; j++) {
+      raw->items[j].start = tsel_shift_byte(raw->items[j].start, edit);
+      raw->items[j].end = tsel_shift_byte(raw->items[j].end, edit);
+    }
+    ok = tsel_range_list_push(raw, edit->start_byte, edit->new_end_byte);
+  }
+  uint32_t changed_count = 0;
+  TSRange *changed = NULL;
+  if(ok && old_tree != new_tree) {
+    changed = ts_tree_get_changed_ranges(old_tree->tree, new_tree->tree, &changed_count);
+  }
+  for(uint32_t i = 0; i < changed_count && ok; i++) {
+    ok = tsel_range_list_push(raw, changed[i].start_byte, changed[i].end_byte);
+  }
+  tsel_ts_free(changed);
+  if(ok) {
+    qsort(raw->items, raw->count, sizeof(TSElByteRange), &tsel_byte_range_compare);
+  }
+  return ok;
+}
+
+static bool tsel_qresult_node_relevant(const TSElQuery *query, TSTreeCursor *cursor,
+                                       const TSElByteRange *range) {
+  // The cursor is on a node touching RANGE. Checks it and every node
+  // below it touching RANGE.
+  if(tsel_query_symbol_relevant(query, ts_node_symbol(ts_tree_cursor_current_node(cursor)))) {
+    return true;
+  }
+  // Start one byte early so nodes ending right at the range are seen
+  uint32_t byte = range->start > 0 ? range->start - 1 : 0;
+  if(ts_tree_cursor_goto_first_child_for_byte(cursor, byte) < 0) {
+    return false;
+  }
+  bool relevant = false;
+  do {
+    TSNode child = ts_tree_cursor_current_node(cursor);
+    if(ts_node_start_byte(child) > range->end) {
+      break;
+    }
+    relevant = ts_node_end_byte(child) >= range->start &&
+      tsel_qresult_node_relevant(query, cursor, range);
+  } while(!relevant && ts_tree_cursor_goto_next_sibling(cursor));
+  ts_tree_cursor_goto_parent(cursor);
+  return relevant;
+}
+
+static bool tsel_qresult_tree_relevant(const TSElQuery *query, TSTree *tree,
+                                       const tsel_range_list *changes) {
+  TSTreeCursor cursor = ts_tree_cursor_new(ts_tree_root_node(tree));
+  bool relevant = false;
+  for(size_t i = 0; i < changes->count && !relevant; i++) {
+    ts_tree_cursor_reset(&cursor, ts_tree_root_node(tree));
+    relevant = tsel_qresult_node_relevant(query, &cursor, &changes->items[i]);
+  }
+  ts_tree_cursor_delete(&cursor);
+  return relevant;
+}
+
+static bool tsel_qresult_relevant(const TSElQuery *query, TSElTree *old_tree, TSElTree *new_tree,
+                                  const tsel_range_list *changes) {
+  // The old tree has been edited, so its nodes are in the same
+  // coordinates, and nodes in deleted text are empty at the edit
+  if(query->symbols_any) {
+    return changes->count > 0;
+  }
+  return tsel_qresult_tree_relevant(query, new_tree->tree, changes) ||
+    tsel_qresult_tree_relevant(query, old_tree->tree, changes);
+}
+
+static bool tsel_qresult_regions(TSElQuery *query, TSElTree *old_tree, uint32_t edit_mark,
+                                 TSElTree *new_tree, tsel_range_list *regions) {
+  tsel_range_list raw = {0};
+  bool ok = tsel_qresult_changes(old_tree, edit_mark, new_tree, &raw);
+  if(!ok) {
+    free(raw.items);
+    return false;
+  }
+  // Changes where none of the node types of the query are found leave
+  // its captures alone, so only shifting them is needed
+  if(!tsel_qresult_relevant(query, old_tree, new_tree, &raw)) {
+    free(raw.items);
+    return true;
+  }
+  // Widen to the top-level nodes touching each range, and to the named
+  // top-level node on either side, which a pattern over siblings can
+  // match together with a changed node
+  for(size_t i = 0; i < raw.count && ok; i++) {
+    ok = tsel_range_list_push(regions, raw.items[i].start, raw.items[i].end);
+  }
+  TSTreeCursor cursor = ts_tree_cursor_new(ts_tree_root_node(new_tree->tree));
+  size_t next = 0;
+  bool have_named = false, take_next = false;
+  uint32_t named_start = 0;
+  if(ok && ts_tree_cursor_goto_first_child(&cursor)) {
+    do {
+      TSNode child = ts_tree_cursor_current_node(&cursor);
+      uint32_t start = ts_node_start_byte(child), end = ts_node_end_byte(child);
+      while(next < raw.count && raw.items[next].end < start) {
+        next++;
+      }
+      if(next < raw.count && raw.items[next].start <= end) {
+        ok = tsel_range_list_push(regions, have_named ? named_start : start, end);
+        take_next = true;
+      }
+      else if(take_next) {
+        ok = tsel_range_list_push(regions, start, end);
+        take_next = !ts_node_is_named(child);
+      }
+      else if(next == raw.count) {
+        break;
+      }
+      if(ts_node_is_named(child)) {
+        have_named = true;
+        named_start = start;
+      }
+    } while(ok && ts_tree_cursor_goto_next_sibling(&cursor));
+  }
+  ts_tree_cursor_delete(&cursor);
+  free(raw.items);
+  if(!ok) {
+    return false;
+  }
+  tsel_range_list_merge(regions);
+  return true;
+}
+
+static bool tsel_qresult_run(TSElQuery *query, TSNode root, const tsel_range_list *regions,
+                             TSElTextSource *source, tsel_result_list *out) {
+  TSQueryCursor *cursor = tsel_query_cursor_take(query);
+  if(!cursor) {
+    return false;
+  }
+  bool ok = true;
+  for(size_t i = 0; i < regions->count && ok; i++) {
+    ts_query_cursor_set_byte_range(cursor, regions->items[i].start, regions->items[i].end);
+    ts_query_cursor_exec(cursor, query->query, root);
+    TSQueryMatch match;
+    uint32_t index;
+    while(ok && tsel_qcursor_next_raw(cursor, query->predicates, source, &match, &index)) {
+      // Keep every capture of the match, since the cursor skips those
+      // outside the region. A match comes back once per capture, and
+      // the copies are dropped after sorting.
+      uint32_t match_start = UINT32_MAX, match_end = 0;
+      for(uint16_t j = 0; j < match.capture_count; j++) {
+        TSNode node = match.captures[j].node;
+        if(ts_node_start_byte(node) < match_start) {
+          match_start = ts_node_start_byte(node);
+        }
+        if(ts_node_end_byte(node) > match_end) {
+          match_end = ts_node_end_byte(node);
+        }
+      }
+      for(uint16_t j = 0; j < match.capture_count && ok; j++) {
+        TSNode node = match.captures[j].node;
+        TSElResultCapture capture = {
+          .node = node,
+          .start = ts_node_start_byte(node),
+          .end = ts_node_end_byte(node),
+          .match_start = match_start,
+          .match_end = match_end,
+          .capture = match.captures[j].index,
+          .pattern = match.pattern_index,
+          .symbol = ts_node_symbol(node),
+          .stale = false,
+        };
+        ok = tsel_result_list_push(out, &capture);
+      }
+    }
+    if(source->env && tsel_pending_nonlocal_exit(source->env)) {
+      ok = false;
+    }
+  }
+  tsel_query_cursor_return(query, cursor);
+  if(!ok) {
+    return false;
+  }
+  qsort(out->items, out->count, sizeof(TSElResultCapture), &tsel_result_capture_compare);
+  size_t kept = 0;
+  for(size_t i = 0; i < out->count; i++) {
+    if(kept == 0 || tsel_result_capture_compare(&out->items[kept - 1], &out->items[i]) != 0) {
+      out->items[kept++] = out->items[i];
+    }
+  }
+  out->count = kept;
+  return true;
+}
+
+static bool tsel_qresult_relocate(TSElNodePath *path, uint32_t start, uint32_t end,
+                                  TSSymbol symbol, TSNode *node) {
+  if(!tsel_node_path_seek_range(path, start, end)) {
+    return false;
+  }
+  // The deepest node with the range comes first, then any ancestors
+  // sharing it
+  for(uint32_t depth = path->depth; depth > 0; depth--) {
+    TSNode candidate = path->nodes[depth - 1];
+    if(ts_node_start_byte(candidate) != start || ts_node_end_byte(candidate) != end) {
+      if(depth < path->depth) {
+        break;
+      }
+      continue;
+    }
+    if(ts_node_symbol(candidate) == symbol) {
+      *node = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool tsel_qresult_refresh(TSElQueryResult *result, TSElResultCapture *capture) {
+  // Find the node of a capture kept over an update in the current tree
+  if(result->path.depth == 0 &&
+     !tsel_node_path_push(&result->path, ts_tree_root_node(result->tree->tree))) {
+    return false;
+  }
+  if(!tsel_qresult_relocate(&result->path, capture->start, capture->end,
+                            capture->symbol, &capture->node)) {
+    return false;
+  }
+  capture->stale = false;
+  return true;
+}
+
+static uint32_t tsel_qresult_shift(uint32_t byte, const TSElTree *old_tree, uint32_t edit_mark) {
+  for(uint32_t i = edit_mark; i < old_tree->edit_count; i++) {
+    byte = tsel_shift_byte(byte, &old_tree->edits[i]);
+  }
+  return byte;
+}
+
+static bool tsel_qresult_update(TSElQueryResult *result, TSElTree *tree,
+                                TSElTextSource *source, tsel_range_list *regions) {
+  TSElTree *old_tree = result->tree;
+  if(old_tree && !tsel_qresult_regions(result->query, old_tree, result->edit_mark, tree, regions)) {
+    return false;
+  }
+  if(!old_tree && !tsel_range_list_push(regions, 0, UINT32_MAX)) {
+    return false;
+  }
+  // Shift the old captures, dropping every match reaching into a
+  // region. The query is run again over those matches too, so the ones
+  // still there come back whole.
+  // RESULT is left alone until the update can no longer fail
+  TSElResultCapture *old = malloc((result->count ? result->count : 1) * sizeof(TSElResultCapture));
+  if(!old) {
+    return false;
+  }
+  size_t kept = 0;
+  size_t region_count = regions->count;
+  bool ok = true;
+  for(size_t i = 0; i < result->count && ok; i++) {
+    TSElResultCapture capture = result->captures[i];
+    if(old_tree != tree) {
+      capture.start = tsel_qresult_shift(capture.start, old_tree, result->edit_mark);
+      capture.end = tsel_qresult_shift(capture.end, old_tree, result->edit_mark);
+      capture.match_start = tsel_qresult_shift(capture.match_start, old_tree, result->edit_mark);
+      capture.match_end = tsel_qresult_shift(capture.match_end, old_tree, result->edit_mark);
+      capture.stale = true;
+    }
+    // Only the merged regions are searched, not the matches pushed after
+    if(tsel_range_list_touches(regions->items, region_count,
+                               capture.match_start, capture.match_end)) {
+      ok = tsel_range_list_push(regions, capture.match_start, capture.match_end);
+      continue;
+    }
+    old[kept++] = capture;
+  }
+  if(!ok) {
+    free(old);
+    return false;
+  }
+  tsel_range_list_merge(regions);
+  tsel_result_list found = {0};
+  if(!tsel_qresult_run(result->query, ts_tree_root_node(tree->tree), regions, source, &found)) {
+    free(found.items);
+    free(old);
+    return false;
+  }
+  // Both lists are sorted, so merge them, keeping the fresh copy of a
+  // capture found again
+  size_t total = kept + found.count;
+  TSElResultCapture *captures = malloc((total ? total : 1) * sizeof(TSElResultCapture));
+  if(!captures) {
+    free(found.items);
+    free(old);
+    return false;
+  }
+  size_t count = 0, i = 0, j = 0;
+  while(i < kept || j < found.count) {
+    int order = i == kept ? 1 : j == found.count ? -1 :
+      tsel_result_capture_compare(&old[i], &found.items[j]);
+    if(order < 0) {
+      captures[count++] = old[i++];
+      continue;
+    }
+    if(order == 0) {
+      i++;
+    }
+    captures[count++] = found.items[j++];
+  }
+  free(found.items);
+  free(old);
+  free(result->captures);
+  result->captures = captures;
+  result->count = count;
+  result->path.depth = 0;
+  tsel_tree_retain(tree);
+  tsel_tree_release(old_tree);
+  result->tree = tree;
+  result->edit_mark = tsel_tree_mark_edits(tree);
+  return true;
+}
+
+static void tsel_qresult_fin(void *ptr) {
+  TSElQueryResult *result = ptr;
+  tsel_query_release(result->query);
+  tsel_tree_release(result->tree);
+  tsel_node_path_free(&result->path);
+  free(result->captures);
+  free(result);
+}
+
+static const char *tsel_query_result_new_doc = "Run QUERY over all of TREE and keep the captures.\n"
+  "The result can be brought up to date with a reparsed tree using\n"
+  "`tree-sitter-query-result-update', which only runs QUERY again where\n"
+  "the tree changed. Text predicates in QUERY are checked against BUFFER,\n"
+  "which defaults to the current buffer.\n"
+  "\n"
+  "(fn QUERY TREE &optional BUFFER)";
+static emacs_value tsel_query_result_new(emacs_env *env,
+                                         ptrdiff_t nargs,
+                                         emacs_value *args,
+                                         __attribute__((unused)) void *data) {
+  TSElQuery *query;
+  TSElTree *tree;
+  TSEL_SUBR_EXTRACT(query, env, args[0], &query);
+  TSEL_SUBR_EXTRACT(tree, env, args[1], &tree);
+  TSElQueryResult *result = calloc(1, sizeof(TSElQueryResult));
+  if(!result) {
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  tsel_query_retain(query);
+  result->query = query;
+  TSElTextSource source;
+  tsel_text_source_init_buffer(&source, env, nargs > 2 ? args[2] : tsel_Qnil);
+  tsel_range_list regions = {0};
+  bool ok = tsel_qresult_update(result, tree, &source, &regions);
+  free(regions.items);
+  tsel_text_source_free(&source);
+  if(!ok) {
+    tsel_qresult_fin(result);
+    if(!tsel_pending_nonlocal_exit(env)) {
+      tsel_signal_error(env, "Allocation failed.");
+    }
+    return tsel_Qnil;
+  }
+  emacs_value Qts_query_result_create = env->intern(env, "tree-sitter-query-result--create");
+  emacs_value user_ptr = env->make_user_ptr(env, &tsel_qresult_fin, result);
+  emacs_value func_args[1] = { user_ptr };
+  return env->funcall(env, Qts_query_result_create, 1, func_args);
+}
+
+static const char *tsel_query_result_update_doc = "Bring RESULT up to date with TREE.\n"
+  "TREE must have been parsed using the tree of RESULT, after editing it\n"
+  "with `tree-sitter-tree-edit', as `tree-sitter-live-mode' does. The query\n"
+  "is run again over the top-level nodes touching an edit or a range which\n"
+  "changed between the trees, together with the named top-level node on\n"
+  "either side and every old match reaching into them. Captures of the\n"
+  "other matches are shifted past the edits and kept, and their nodes are\n"
+  "looked up in TREE when next returned. A match reaching further than a\n"
+  "top-level neighbour of a change, such as one over a long run of\n"
+  "sibling nodes, can be missed. When none of the changes touch a node\n"
+  "type the query can match, see `tree-sitter-query-pattern-symbols', the\n"
+  "query is not run at all. BUFFER is as for `tree-sitter-query-result-new'.\n"
+  "Returns a list of (START . END) byte ranges where the query was run.\n"
+  "\n"
+  "(fn RESULT TREE &optional BUFFER)";
+static emacs_value tsel_query_result_update(emacs_env *env,
+                                            ptrdiff_t nargs,
+                                            emacs_value *args,
+                                            __attribute__((unused)) void *data) {
+  TSElQueryResult *result;
+  TSElTree *tree;
+  TSEL_SUBR_EXTRACT(qresult, env, args[0], &result);
+  TSEL_SUBR_EXTRACT(tree, env, args[1], &tree);
+  if(tree == result->tree && tree->edit_count != result->edit_mark) {
+    tsel_signal_error(env, "Tree has been edited but not reparsed.");
+    return tsel_Qnil;
+  }
+  TSElTextSource source;
+  tsel_text_source_init_buffer(&source, env, nargs > 2 ? args[2] : tsel_Qnil);
+  tsel_range_list regions = {0};
+  bool ok = tsel_qresult_update(result, tree, &source, &regions);
+  tsel_text_source_free(&source);
+  if(!ok) {
+    free(regions.items);
+    if(!tsel_pending_nonlocal_exit(env)) {
+      tsel_signal_error(env, "Allocation failed.");
+    }
+    return tsel_Qnil;
+  }
+  emacs_value Qcons = env->intern(env, "cons");
+  emacs_value ranges = tsel_Qnil;
+  for(size_t i = regions.count; i > 0 && !tsel_pending_nonlocal_exit(env); i--) {
+    emacs_value bounds[2] = {
+      env->make_integer(env, regions.items[i - 1].start + 1),
+      env->make_integer(env, (intmax_t) regions.items[i - 1].end + 1),
+    };
+    emacs_value range = env->funcall(env, Qcons, 2, bounds);
+    emacs_value cons_args[2] = { range, ranges };
+    ranges = env->funcall(env, Qcons, 2, cons_args);
+  }
+  free(regions.items);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return ranges;
+}
+
+static const char *tsel_query_changes_relevant_p_doc = "Return t if changes from OLD-TREE to NEW-TREE may affect QUERY.\n"
+  "OLD-TREE is the tree edited with `tree-sitter-tree-edit' and passed to\n"
+  "the parser to get NEW-TREE. OLD-TREE keeps every edit made to it, so\n"
+  "edits changing only text, such as renaming an identifier, count even\n"
+  "when the trees have the same structure. The nodes touching the edits\n"
+  "and the ranges that changed between the trees are checked against the\n"
+  "node types the patterns of QUERY can match, without running QUERY.\n"
+  "When this returns nil, captures of QUERY from OLD-TREE are still valid\n"
+  "after shifting them past the edits.\n"
+  "\n"
+  "(fn QUERY OLD-TREE NEW-TREE)";
+static emacs_value tsel_query_changes_relevant_p(emacs_env *env,
+                                                 __attribute__((unused)) ptrdiff_t nargs,
+                                                 emacs_value *args,
+                                                 __attribute__((unused)) void *data) {
+  TSElQuery *query;
+  TSElTree *old_tree, *new_tree;
+  TSEL_SUBR_EXTRACT(query, env, args[0], &query);
+  TSEL_SUBR_EXTRACT(tree, env, args[1], &old_tree);
+  TSEL_SUBR_EXTRACT(tree, env, args[2], &new_tree);
+  tsel_range_list changes = {0};
+  if(!tsel_qresult_changes(old_tree, 0, new_tree, &changes)) {
+    free(changes.items);
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  bool relevant = tsel_qresult_relevant(query, old_tree, new_tree, &changes);
+  free(changes.items);
+  return relevant ? tsel_Qt : tsel_Qnil;
+}
+
+static const char *tsel_query_result_captures_doc = "Return the captures in RESULT as one vector.\n"
+  "The vector is laid out as for `tree-sitter-query-captures', with the\n"
+  "nodes belonging to the tree RESULT was last updated with. Captures are\n"
+  "ordered by start byte, and a node captured under the same name by\n"
+  "several matches of one pattern appears once. START and END optionally\n"
+  "limit the vector to captures overlapping that range of bytes.\n"
+  "\n"
+  "(fn RESULT &optional START END)";
+static emacs_value tsel_query_result_captures(emacs_env *env,
+                                              ptrdiff_t nargs,
+                                              emacs_value *args,
+                                              __attribute__((unused)) void *data) {
+  TSElQueryResult *result;
+  intmax_t start = 1, end = (intmax_t) UINT32_MAX + 1;
+  TSEL_SUBR_EXTRACT(qresult, env, args[0], &result);
+  if(nargs > 1 && env->is_not_nil(env, args[1])) {
+    TSEL_SUBR_EXTRACT(integer, env, args[1], &start);
+  }
+  if(nargs > 2 && env->is_not_nil(env, args[2])) {
+    TSEL_SUBR_EXTRACT(integer, env, args[2], &end);
+  }
+  TSElByteRange range = { start - 1, end - 1 };
+  // Captures are sorted by start, so stop at the first past the range.
+  // Stale captures are looked up here, and skipped if they are gone.
+  size_t count = 0;
+  for(size_t i = 0; i < result->count; i++) {
+    TSElResultCapture *capture = &result->captures[i];
+    if(capture->start > range.end) {
+      break;
+    }
+    if(tsel_byte_range_overlaps(capture->start, capture->end, &range) &&
+       (!capture->stale || tsel_qresult_refresh(result, capture))) {
+      count++;
+    }
+  }
+  emacs_value vector = tsel_make_vector(env, count * TSEL_CAPTURE_ENTRY_SIZE, tsel_Qnil);
+  size_t offset = 0;
+  for(size_t i = 0; i < result->count && offset < count; i++) {
+    TSElResultCapture *capture = &result->captures[i];
+    if(capture->stale || !tsel_byte_range_overlaps(capture->start, capture->end, &range)) {
+      continue;
+    }
+    TSElCapture entry = { capture->node, capture->capture, capture->pattern };
+    tsel_qcursor_capture_entry(env, vector, offset * TSEL_CAPTURE_ENTRY_SIZE,
+                               result->query, &entry, result->tree);
+    offset++;
+    if(tsel_pending_nonlocal_exit(env)) {
+      return tsel_Qnil;
+    }
+  }
+  return vector;
+}
+
+static const char *tsel_query_result_p_wrapped_doc = "Return t if OBJECT is a tree-sitter-query-result.\n"
+  "\n"
+  "(fn OBJECT)";
+static emacs_value tsel_query_result_p_wrapped(emacs_env *env,
+                                               __attribute__((unused)) ptrdiff_t nargs,
+                                               emacs_value *args,
+                                               __attribute__((unused)) void *data) {
+  if(tsel_qresult_p(env, args[0])) {
+    return tsel_Qt;
+  }
+  return tsel_Qnil;
+}
+
+bool tsel_qresult_init(emacs_env *env) {
+  bool function_result = tsel_define_function(env, "tree-sitter-query-result-p",
+                                              &tsel_query_result_p_wrapped, 1, 1,
+                                              tsel_query_result_p_wrapped_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-query-result-new",
+                                          &tsel_query_result_new, 2, 3,
+                                          tsel_query_result_new_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-query-result-update",
+                                          &tsel_query_result_update, 2, 3,
+                                          tsel_query_result_update_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-query-result-captures",
+                                          &tsel_query_result_captures, 1, 3,
+                                          tsel_query_result_captures_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-query-changes-relevant-p",
+                                          &tsel_query_changes_relevant_p, 3, 3,
+                                          tsel_query_changes_relevant_p_doc, NULL);
+  return function_result;
+}
+
+bool tsel_qresult_p(emacs_env *env, emacs_value obj) {
+  if(!tsel_check_record_type(env, "tree-sitter-query-result", obj, 1)) {
+    return false;
+  }
+  // Get the ptr field
+  emacs_value user_ptr;
+  if(!tsel_record_get_field(env, obj, 1, &user_ptr)) {
+    return false;
+  }
+  // Make sure it's a user pointer
+  emacs_value Quser_ptrp = env->intern(env, "user-ptrp");
+  emacs_value args[1] = { user_ptr };
+  if(!env->eq(env, env->funcall(env, Quser_ptrp, 1, args), tsel_Qt) ||
+     tsel_pending_nonlocal_exit(env)) {
+    return false;
+  }
+  // Check the finalizer
+  emacs_finalizer *fin = env->get_user_finalizer(env, user_ptr);
+  return !tsel_pending_nonlocal_exit(env) && fin == &tsel_qresult_fin;
+}
+
+bool tsel_extract_qresult(emacs_env *env, emacs_value obj, TSElQueryResult **result) {
+  if(!tsel_qresult_p(env, obj)) {
+    tsel_signal_wrong_type(env, "tree-sitter-query-result-p", obj);
+    return false;
+  }
+  // Get the ptr field
+  emacs_value user_ptr;
+  if(!tsel_record_get_field(env, obj, 1, &user_ptr)) {
+    return false;
+  }
+  // Get the raw pointer
+  TSElQueryResult *ptr = env->get_user_ptr(env, user_ptr);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return false;
+  }
+  *result = ptr;
+  return true;
+}
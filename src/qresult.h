@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2019 Karl Otness
+ *
+ * This file is part of tree-sitter.el.
+ *
+ * tree-sitter.el is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * tree-sitter.el is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tree-sitter.el. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#ifndef TSEL_QRESULT_H
+#define TSEL_QRESULT_H
+#include <stdbool.h>
+#include <emacs-module.h>
+#include "tree_sitter/api.h"
+#include "tree.h"
+#include "query.h"
+#include "qcursor.h"
+
+// One capture kept in a result, with the bytes its whole match covers.
+// Bytes are in the coordinates of the result's tree. NODE is from an
+// older tree while STALE is set, and is looked up again from the bytes
+// and symbol when the capture is next returned.
+typedef struct TSElResultCapture {
+  TSNode node;
+  uint32_t start;
+  uint32_t end;
+  uint32_t match_start;
+  uint32_t match_end;
+  uint32_t capture;
+  uint32_t pattern;
+  TSSymbol symbol;
+  bool stale;
+} TSElResultCapture;
+
+// The captures of a query over a whole tree, kept up to date across
+// reparses by re-running the query only where the tree changed
+typedef struct TSElQueryResult {
+  TSElQuery *query;
+  TSElTree *tree;
+  // Edits of TREE made after the captures were found
+  uint32_t edit_mark;
+  // Sorted in document order
+  TSElResultCapture *captures;
+  size_t count;
+  // Path into TREE reused while looking up stale captures
+  TSElNodePath path;
+} TSElQueryResult;
+
+bool tsel_qresult_init(emacs_env *env);
+bool tsel_qresult_p(emacs_env *env, emacs_value obj);
+bool tsel_extract_qresult(emacs_env *env, emacs_value obj, TSElQueryResult **result);
+
+#endif //ifndef TSEL_QRESULT_H
@@ -18,9 +18,11 @@
  * <https://www.gnu.org/licenses/>.
  */
 
+#include <ctype.h>
 #include <emacs-module.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "query.h"
 #include "common.h"
@@ -29,56 +31,681 @@
 
 static void tsel_query_fin(void *ptr) {
   TSElQuery *query = ptr;
-  ts_query_delete(query->query);
-  free(query);
+  tsel_query_release(query);
+}
+
+/*
+ * Compiled queries are shared through a cache keyed by language and
+ * source text. The cache holds one reference to each query and every
+ * Lisp query object holds another, so a flushed or evicted query lives
+ * on until the last object using it is collected. Past
+ * TSEL_QUERY_CACHE_LIMIT entries the least recently used one is evicted.
+ */
+#define TSEL_QUERY_CACHE_BUCKETS 64
+#define TSEL_QUERY_CACHE_LIMIT 128
+
+typedef struct TSElQueryCacheEntry {
+  const TSLanguage *language;
+  uint64_t hash;
+  char *key;
+  size_t key_length;
+  TSElQuery *query;
+  // Value of tsel_query_cache_clock when last looked up
+  uint64_t used;
+  struct TSElQueryCacheEntry *next;
+} TSElQueryCacheEntry;
+
+static TSElQueryCacheEntry *tsel_query_cache[TSEL_QUERY_CACHE_BUCKETS];
+static size_t tsel_query_cache_count = 0;
+static uint64_t tsel_query_cache_clock = 0;
+
+/*
+ * Queries hold global references to Lisp values, which can only be
+ * freed through an env. Queries are mostly released from finalizers,
+ * which have none, so their references are queued here and freed by
+ * the next function in this file that has an env.
+ */
+static emacs_value *tsel_query_dead_refs = NULL;
+static size_t tsel_query_dead_ref_count = 0;
+static size_t tsel_query_dead_ref_capacity = 0;
+
+static void tsel_query_queue_ref(emacs_value ref) {
+  if (!ref) {
+    return;
+  }
+  if (tsel_query_dead_ref_count == tsel_query_dead_ref_capacity) {
+    size_t capacity = tsel_query_dead_ref_capacity ? tsel_query_dead_ref_capacity * 2 : 64;
+    emacs_value *refs = realloc(tsel_query_dead_refs, capacity * sizeof(emacs_value));
+    if (!refs) {
+      // Leaking the reference is all that can be done
+      return;
+    }
+    tsel_query_dead_refs = refs;
+    tsel_query_dead_ref_capacity = capacity;
+  }
+  tsel_query_dead_refs[tsel_query_dead_ref_count++] = ref;
+}
+
+static void tsel_query_free_dead_refs(emacs_env *env) {
+  for (size_t i = 0; i < tsel_query_dead_ref_count; i++) {
+    env->free_global_ref(env, tsel_query_dead_refs[i]);
+  }
+  tsel_query_dead_ref_count = 0;
+}
+
+static void tsel_query_cache_entry_free(TSElQueryCacheEntry *entry) {
+  tsel_query_release(entry->query);
+  free(entry->key);
+  free(entry);
+}
+
+static void tsel_query_cache_evict(void) {
+  TSElQueryCacheEntry **oldest = NULL;
+  for (int i = 0; i < TSEL_QUERY_CACHE_BUCKETS; i++) {
+    for (TSElQueryCacheEntry **link = &tsel_query_cache[i]; *link; link = &(*link)->next) {
+      if (!oldest || (*link)->used < (*oldest)->used) {
+        oldest = link;
+      }
+    }
+  }
+  if (oldest) {
+    TSElQueryCacheEntry *entry = *oldest;
+    *oldest = entry->next;
+    tsel_query_cache_entry_free(entry);
+    tsel_query_cache_count--;
+  }
+}
+
+static uint64_t tsel_query_hash(const char *key, size_t length) {
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (unsigned char) key[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+TSElQuery *tsel_query_cache_get(const TSLanguage *language, const char *key, size_t length) {
+  uint64_t hash = tsel_query_hash(key, length);
+  for (TSElQueryCacheEntry *entry = tsel_query_cache[hash % TSEL_QUERY_CACHE_BUCKETS];
+       entry; entry = entry->next) {
+    if (entry->language == language && entry->hash == hash &&
+        entry->key_length == length && memcmp(entry->key, key, length) == 0) {
+      entry->used = ++tsel_query_cache_clock;
+      tsel_query_retain(entry->query);
+      return entry->query;
+    }
+  }
+  return NULL;
+}
+
+void tsel_query_cache_put(const TSLanguage *language, const char *key, size_t length,
+                          TSElQuery *query) {
+  // Caching is best effort, so allocation failures just skip it
+  TSElQueryCacheEntry *entry = malloc(sizeof(TSElQueryCacheEntry));
+  char *copy = malloc(length + 1);
+  if (!entry || !copy) {
+    free(entry);
+    free(copy);
+    return;
+  }
+  if (tsel_query_cache_count >= TSEL_QUERY_CACHE_LIMIT) {
+    tsel_query_cache_evict();
+  }
+  memcpy(copy, key, length);
+  copy[length] = '\0';
+  entry->language = language;
+  entry->hash = tsel_query_hash(key, length);
+  entry->key = copy;
+  entry->key_length = length;
+  entry->query = query;
+  entry->used = ++tsel_query_cache_clock;
+  tsel_query_retain(query);
+  TSElQueryCacheEntry **bucket = &tsel_query_cache[entry->hash % TSEL_QUERY_CACHE_BUCKETS];
+  entry->next = *bucket;
+  *bucket = entry;
+  tsel_query_cache_count++;
+}
+
+/*
+ * The node types a pattern can match are read from its source, since
+ * tree-sitter does not expose compiled patterns. Node names in
+ * parentheses and quoted anonymous nodes are looked up in the
+ * language; fields, captures, quantifiers and predicates are skipped.
+ * Wildcards, anchors and names which are not plain visible symbols,
+ * such as ERROR, MISSING or supertypes, make the pattern match any
+ * node. Anchors count because inserting a node of any type between
+ * anchored siblings breaks the match.
+ */
+static bool tsel_query_name_start(char c) {
+  return isalnum((unsigned char) c) || c == '_' || c == '-';
+}
+
+static bool tsel_query_name_char(char c) {
+  return tsel_query_name_start(c) || c == '.' || c == '?' || c == '!';
+}
+
+static size_t tsel_query_skip_name(const char *text, size_t length, size_t i) {
+  while (i < length && tsel_query_name_char(text[i])) {
+    i++;
+  }
+  return i;
+}
+
+static size_t tsel_query_skip_group(const char *text, size_t length, size_t i) {
+  // I is at an opening parenthesis. Returns the index past its match.
+  uint32_t depth = 0;
+  while (i < length) {
+    char c = text[i++];
+    if (c == '"') {
+      while (i < length && text[i] != '"') {
+        i += text[i] == '\\' ? 2 : 1;
+      }
+      i++;
+    } else if (c == ';') {
+      while (i < length && text[i] != '\n') {
+        i++;
+      }
+    } else if (c == '(') {
+      depth++;
+    } else if (c == ')' && --depth == 0) {
+      break;
+    }
+  }
+  return i;
+}
+
+static bool tsel_query_add_type(const TSLanguage *language, const char *name, size_t length,
+                                bool named, TSElSymbolSet *set) {
+  // Aliases can give several symbols the same name
+  bool found = false;
+  uint32_t count = ts_language_symbol_count(language);
+  for (TSSymbol symbol = 0; symbol < count; symbol++) {
+    TSSymbolType type = ts_language_symbol_type(language, symbol);
+    if (type != (named ? TSSymbolTypeRegular : TSSymbolTypeAnonymous)) {
+      continue;
+    }
+    const char *symbol_name = ts_language_symbol_name(language, symbol);
+    if (strlen(symbol_name) == length && memcmp(symbol_name, name, length) == 0) {
+      tsel_symbol_set_add(set, symbol);
+      found = true;
+    }
+  }
+  return found;
+}
+
+static bool tsel_query_scan_pattern(const TSLanguage *language, const char *text, size_t length,
+                                    TSElSymbolSet *set) {
+  // Returns false if the pattern can match any node
+  size_t i = 0;
+  while (i < length) {
+    char c = text[i];
+    if (c == ';') {
+      while (i < length && text[i] != '\n') {
+        i++;
+      }
+    } else if (c == '"') {
+      char name[256];
+      size_t name_length = 0;
+      for (i++; i < length && text[i] != '"'; i++) {
+        char n = text[i];
+        if (n == '\\' && i + 1 < length) {
+          n = text[++i];
+          n = n == 'n' ? '\n' : n == 't' ? '\t' : n == 'r' ? '\r' : n == '0' ? '\0' : n;
+        }
+        if (name_length == sizeof(name)) {
+          return false;
+        }
+        name[name_length++] = n;
+      }
+      i++;
+      if (!tsel_query_add_type(language, name, name_length, false, set)) {
+        return false;
+      }
+    } else if (c == '(') {
+      size_t j = i + 1;
+      while (j < length && isspace((unsigned char) text[j])) {
+        j++;
+      }
+      if (j < length && text[j] == '#') {
+        i = tsel_query_skip_group(text, length, i);
+        continue;
+      }
+      i = j;
+      if (i >= length || !tsel_query_name_start(text[i])) {
+        continue;
+      }
+      size_t end = tsel_query_skip_name(text, length, i);
+      if (end - i == 1 && text[i] == '_') {
+        return false;
+      }
+      if (end < length && text[end] == '/') {
+        // A supertype with one of its subtypes, which is what matches
+        i = end + 1;
+        end = tsel_query_skip_name(text, length, i);
+      }
+      if (!tsel_query_add_type(language, text + i, end - i, true, set)) {
+        return false;
+      }
+      i = end;
+    } else if (c == '@') {
+      i = tsel_query_skip_name(text, length, i + 1);
+    } else if (c == '.') {
+      return false;
+    } else if (tsel_query_name_start(c)) {
+      // A field name, or a bare wildcard
+      size_t end = tsel_query_skip_name(text, length, i);
+      if (end - i == 1 && c == '_') {
+        return false;
+      }
+      i = end;
+    } else {
+      i++;
+    }
+  }
+  return true;
+}
+
+static void tsel_query_symbols_free(TSElQuery *query) {
+  uint32_t patterns = ts_query_pattern_count(query->query);
+  for (uint32_t i = 0; query->pattern_symbols && i < patterns; i++) {
+    tsel_symbol_set_free(&query->pattern_symbols[i]);
+  }
+  free(query->pattern_symbols);
+  free(query->pattern_any);
+  tsel_symbol_set_free(&query->symbols);
+}
+
+static bool tsel_query_scan_symbols(TSElQuery *query, const TSLanguage *language,
+                                    const char *source, size_t length) {
+  uint32_t patterns = ts_query_pattern_count(query->query);
+  uint32_t count = ts_language_symbol_count(language);
+  query->language = language;
+  query->symbols_any = false;
+  query->pattern_symbols = calloc(patterns + 1, sizeof(TSElSymbolSet));
+  query->pattern_any = calloc(patterns + 1, sizeof(bool));
+  if (!tsel_symbol_set_init(&query->symbols, count) || !query->pattern_symbols ||
+      !query->pattern_any) {
+    return false;
+  }
+  for (uint32_t i = 0; i < patterns; i++) {
+    // Alternatives at the top level become patterns sharing one start,
+    // so each is scanned up to the next pattern starting later
+    uint32_t start = ts_query_start_byte_for_pattern(query->query, i);
+    size_t end = length;
+    for (uint32_t j = i + 1; j < patterns; j++) {
+      uint32_t next = ts_query_start_byte_for_pattern(query->query, j);
+      if (next > start) {
+        end = next;
+        break;
+      }
+    }
+    TSElSymbolSet *set = &query->pattern_symbols[i];
+    if (!tsel_symbol_set_init(set, count)) {
+      return false;
+    }
+    query->pattern_any[i] = !tsel_query_scan_pattern(language, source + start, end - start, set);
+    query->symbols_any |= query->pattern_any[i];
+    for (uint32_t k = 0; k < count / 64 + 1; k++) {
+      query->symbols.bits[k] |= set->bits[k];
+    }
+  }
+  return true;
+}
+
+bool tsel_query_symbol_relevant(const TSElQuery *query, TSSymbol symbol) {
+  return query->symbols_any || tsel_symbol_set_contains(&query->symbols, symbol);
+}
+
+TSElQuery *tsel_query_compile(emacs_env *env, const TSLanguage *language,
+                              const char *source, size_t length) {
+  tsel_query_free_dead_refs(env);
+  TSQueryError err;
+  uint32_t error_offset;
+  TSQuery *query = ts_query_new(language, source, length, &error_offset, &err);
+  if (!query) {
+    char errinfo[128];
+    const char *errtype[] = {"None", "Syntax", "NodeType", "Field", "Capture"};
+    snprintf(errinfo, sizeof(errinfo), "Initialization failed! TSQueryError:%s,ErrorOffset:%u.",
+             (unsigned) err < sizeof(errtype) / sizeof(errtype[0]) ? errtype[err] : "Unknown",
+             error_offset);
+    tsel_signal_error(env, errinfo);
+    return NULL;
+  }
+  TSElPredicates *predicates;
+  char errinfo[256];
+  if (!tsel_predicates_parse(query, &predicates, errinfo, sizeof(errinfo))) {
+    ts_query_delete(query);
+    tsel_signal_error(env, errinfo);
+    return NULL;
+  }
+  TSElQuery *wrapper = malloc(sizeof(TSElQuery));
+  if (!wrapper) {
+    tsel_predicates_free(predicates);
+    ts_query_delete(query);
+    tsel_signal_error(env, "Initialization failed!");
+    return NULL;
+  }
+  wrapper->refcount = 1;
+  wrapper->query = query;
+  wrapper->capture_symbols = NULL;
+  wrapper->predicates = predicates;
+  wrapper->member_count = 0;
+  wrapper->member_names = NULL;
+  wrapper->pattern_members = NULL;
+  wrapper->pool_count = 0;
+  if (!tsel_query_scan_symbols(wrapper, language, source, length)) {
+    tsel_query_release(wrapper);
+    tsel_signal_error(env, "Initialization failed!");
+    return NULL;
+  }
+  return wrapper;
+}
+
+emacs_value tsel_query_emacs_move(emacs_env *env, TSElQuery *query) {
+  emacs_value new_query = env->make_user_ptr(env, &tsel_query_fin, query);
+  if (tsel_pending_nonlocal_exit(env)) {
+    tsel_query_release(query);
+    return tsel_Qnil;
+  }
+  emacs_value Qts_query_create = env->intern(env, "tree-sitter-query--create");
+  emacs_value funargs[1] = {new_query};
+  return env->funcall(env, Qts_query_create, 1, funargs);
 }
 
 static const char *tsel_query_new_doc =
     "Create a new QUERY\n"
     "LANG is a `tree-sitter-language-p' object.\n"
+    "Compiled queries are cached by LANG and SOURCE, so creating the same\n"
+    "query again shares the compiled query instead of compiling it anew.\n"
+    "The predicates #eq?, #match? and #any-of? and their #not- forms are\n"
+    "checked by the module, and matches failing them are never returned.\n"
+    "#match? takes a POSIX extended regular expression. Other predicates\n"
+    "are left to the caller, see `tree-sitter-query-predicates'.\n"
+    "Since `tree-sitter-disable-capture' changes the compiled query, it\n"
+    "affects every user of a shared query. Pass a non-nil NO-CACHE to get\n"
+    "a private query.\n"
     "\n"
-    "(fn LANG SOURCE)";
+    "(fn LANG SOURCE &optional NO-CACHE)";
 static emacs_value tsel_query_new(emacs_env *env,
-                                  __attribute__((unused)) ptrdiff_t nargs,
+                                  ptrdiff_t nargs,
 				  emacs_value *args,
                                   __attribute__((unused)) void *data) {
   TSElLanguage* lang = NULL;
   char* source = NULL;
   TSEL_SUBR_EXTRACT(language,env,args[0],&lang);
   TSEL_SUBR_EXTRACT(string,env,args[1],&source);
+  bool use_cache = nargs < 3 || !env->is_not_nil(env, args[2]);
+  size_t length = strlen(source);
 
-  TSQueryError err;
-  uint32_t error_offset;
-  TSQuery *query = ts_query_new(lang->ptr,source,strlen(source),&error_offset,&err);
-  
-  TSElQuery *wrapper = malloc(sizeof(TSElQuery));
-  if (!wrapper || !query) {
-    if (wrapper) {
-      free(wrapper);
+  TSElQuery *query = use_cache ? tsel_query_cache_get(lang->ptr, source, length) : NULL;
+  if (!query) {
+    query = tsel_query_compile(env, lang->ptr, source, length);
+    if (query && use_cache) {
+      tsel_query_cache_put(lang->ptr, source, length, query);
+    }
+  }
+  free(source);
+  if (!query) {
+    return tsel_Qnil;
+  }
+  return tsel_query_emacs_move(env, query);
+}
+
+typedef struct tsel_query_bundle_source {
+  char *source;
+  size_t length;
+  char *key;
+  size_t key_length;
+  uint32_t count;
+  uint32_t *offsets;
+  emacs_value *names;
+} tsel_query_bundle_source;
+
+static void tsel_query_bundle_source_free(tsel_query_bundle_source *bundle) {
+  free(bundle->source);
+  free(bundle->key);
+  free(bundle->offsets);
+  free(bundle->names);
+}
+
+static bool tsel_query_bundle_append(char **buf, size_t *length, size_t *capacity,
+                                     const char *str, size_t size) {
+  if (*length + size + 1 > *capacity) {
+    size_t grown = (*length + size + 1) * 2;
+    char *ptr = realloc(*buf, grown);
+    if (!ptr) {
+      return false;
+    }
+    *buf = ptr;
+    *capacity = grown;
+  }
+  memcpy(*buf + *length, str, size);
+  *length += size;
+  (*buf)[*length] = '\0';
+  return true;
+}
+
+static bool tsel_query_bundle_read(emacs_env *env, emacs_value members,
+                                   tsel_query_bundle_source *bundle) {
+  // Join the member sources with newlines, remembering where each one
+  // starts. The cache key leads with the member names and lengths so
+  // bundles never share an entry with a plain query or each other.
+  memset(bundle, 0, sizeof(tsel_query_bundle_source));
+  emacs_value Qlength = env->intern(env, "length");
+  emacs_value Qcar = env->intern(env, "car");
+  emacs_value Qcdr = env->intern(env, "cdr");
+  emacs_value Qsymbolp = env->intern(env, "symbolp");
+  emacs_value Qsymbol_name = env->intern(env, "symbol-name");
+  intmax_t count = env->extract_integer(env, env->funcall(env, Qlength, 1, &members));
+  if (tsel_pending_nonlocal_exit(env)) {
+    return false;
+  }
+  if (count < 1) {
+    tsel_signal_error(env, "A query bundle needs at least one member.");
+    return false;
+  }
+  bundle->count = count;
+  bundle->offsets = malloc(count * sizeof(uint32_t));
+  bundle->names = malloc(count * sizeof(emacs_value));
+  size_t source_capacity = 0, key_capacity = 0;
+  if (!bundle->offsets || !bundle->names ||
+      !tsel_query_bundle_append(&bundle->key, &bundle->key_length, &key_capacity, "\1", 1)) {
+    tsel_signal_error(env, "Allocation failed.");
+    return false;
+  }
+  emacs_value list = members;
+  for (intmax_t i = 0; i < count; i++) {
+    emacs_value member = env->funcall(env, Qcar, 1, &list);
+    emacs_value name = env->funcall(env, Qcar, 1, &member);
+    emacs_value source_obj = env->funcall(env, Qcdr, 1, &member);
+    list = env->funcall(env, Qcdr, 1, &list);
+    if (tsel_pending_nonlocal_exit(env)) {
+      return false;
+    }
+    if (!env->is_not_nil(env, env->funcall(env, Qsymbolp, 1, &name))) {
+      tsel_signal_wrong_type(env, "symbolp", name);
+      return false;
+    }
+    char *name_str, *source;
+    if (!tsel_extract_string(env, env->funcall(env, Qsymbol_name, 1, &name), &name_str)) {
+      return false;
+    }
+    if (!tsel_extract_string(env, source_obj, &source)) {
+      free(name_str);
+      return false;
+    }
+    size_t source_length = strlen(source);
+    char header[32];
+    int header_length = snprintf(header, sizeof(header), "\2%zu\2", source_length);
+    bundle->names[i] = name;
+    bundle->offsets[i] = bundle->length;
+    bool ok = tsel_query_bundle_append(&bundle->key, &bundle->key_length, &key_capacity,
+                                       name_str, strlen(name_str)) &&
+      tsel_query_bundle_append(&bundle->key, &bundle->key_length, &key_capacity,
+                               header, header_length) &&
+      tsel_query_bundle_append(&bundle->source, &bundle->length, &source_capacity,
+                               source, source_length) &&
+      tsel_query_bundle_append(&bundle->source, &bundle->length, &source_capacity, "\n", 1);
+    free(name_str);
+    free(source);
+    if (!ok) {
+      tsel_signal_error(env, "Allocation failed.");
+      return false;
+    }
+  }
+  if (!tsel_query_bundle_append(&bundle->key, &bundle->key_length, &key_capacity,
+                                bundle->source, bundle->length)) {
+    tsel_signal_error(env, "Allocation failed.");
+    return false;
+  }
+  return true;
+}
+
+static bool tsel_query_bundle_attach(emacs_env *env, TSElQuery *query,
+                                     tsel_query_bundle_source *bundle) {
+  uint32_t pattern_count = ts_query_pattern_count(query->query);
+  query->member_names = malloc(bundle->count * sizeof(emacs_value));
+  query->pattern_members = malloc((pattern_count + 1) * sizeof(uint32_t));
+  if (!query->member_names || !query->pattern_members) {
+    return false;
+  }
+  for (uint32_t i = 0; i < bundle->count; i++) {
+    query->member_names[i] = env->make_global_ref(env, bundle->names[i]);
+  }
+  query->member_count = bundle->count;
+  // Patterns are numbered in source order, so one forward scan suffices
+  uint32_t member = 0;
+  for (uint32_t pattern = 0; pattern < pattern_count; pattern++) {
+    uint32_t start = ts_query_start_byte_for_pattern(query->query, pattern);
+    while (member + 1 < bundle->count && bundle->offsets[member + 1] <= start) {
+      member++;
+    }
+    query->pattern_members[pattern] = member;
+  }
+  return true;
+}
+
+static const char *tsel_query_bundle_new_doc =
+    "Create one query out of several query sources for LANG.\n"
+    "MEMBERS is a list of (NAME . SOURCE) pairs where NAME is a symbol and\n"
+    "SOURCE a query source string. The sources are compiled together into\n"
+    "a single query, so one pass over a tree finds the captures of every\n"
+    "member. `tree-sitter-query-bundle-captures' tags each capture with the\n"
+    "NAME of the member its pattern came from.\n"
+    "The result is a `tree-sitter-query-p' object and works with all other\n"
+    "query functions. Bundles are cached like queries from\n"
+    "`tree-sitter-query-new'.\n"
+    "\n"
+    "(fn LANG MEMBERS)";
+static emacs_value tsel_query_bundle_new(emacs_env *env,
+                                         __attribute__((unused)) ptrdiff_t nargs,
+                                         emacs_value *args,
+                                         __attribute__((unused)) void *data) {
+  TSElLanguage *lang;
+  TSEL_SUBR_EXTRACT(language, env, args[0], &lang);
+  tsel_query_bundle_source bundle;
+  if (!tsel_query_bundle_read(env, args[1], &bundle)) {
+    tsel_query_bundle_source_free(&bundle);
+    return tsel_Qnil;
+  }
+  TSElQuery *query = tsel_query_cache_get(lang->ptr, bundle.key, bundle.key_length);
+  if (!query) {
+    query = tsel_query_compile(env, lang->ptr, bundle.source, bundle.length);
+    if (query && !tsel_query_bundle_attach(env, query, &bundle)) {
+      tsel_query_release(query);
+      query = NULL;
+      tsel_signal_error(env, "Allocation failed.");
     }
-    
-    char error[125] = "";
     if (query) {
-      ts_query_delete(query);
-      char* errtype[] = {"None","Syntax","NodeType","Field","Capture"};
-      sprintf(error," TSQueryError:%s,ErrorOffset:%d.",errtype[err],error_offset);
+      tsel_query_cache_put(lang->ptr, bundle.key, bundle.key_length, query);
     }
-    char errinfo[512];
-    sprintf(errinfo,"Initialization failed!%s",error);
-    tsel_signal_error(env, errinfo);
+  }
+  tsel_query_bundle_source_free(&bundle);
+  if (!query) {
     return tsel_Qnil;
   }
-  wrapper->query = query;
-  emacs_value new_query = env->make_user_ptr(env, &tsel_query_fin, wrapper);
-  emacs_value Qts_query_create = env->intern(env, "tree-sitter-query--create");
-  emacs_value funargs[1] = {new_query};
-  emacs_value res = env->funcall(env, Qts_query_create, 1, funargs);
-  if (tsel_pending_nonlocal_exit(env)) {
-    tsel_query_fin(wrapper);
-    tsel_signal_error(env, "Initialization failed");
+  return tsel_query_emacs_move(env, query);
+}
+
+static const char *tsel_query_bundle_members_doc =
+    "Return a vector of the member names of QUERY.\n"
+    "Returns nil if QUERY was not made by `tree-sitter-query-bundle-new'.\n"
+    "\n"
+    "(fn QUERY)";
+static emacs_value tsel_query_bundle_members(emacs_env *env,
+                                             __attribute__((unused)) ptrdiff_t nargs,
+                                             emacs_value *args,
+                                             __attribute__((unused)) void *data) {
+  TSElQuery *q;
+  TSEL_SUBR_EXTRACT(query, env, args[0], &q);
+  if (q->member_count == 0) {
     return tsel_Qnil;
   }
-  return res;
+  emacs_value result = tsel_make_vector(env, q->member_count, tsel_Qnil);
+  for (uint32_t i = 0; i < q->member_count; i++) {
+    env->vec_set(env, result, i, q->member_names[i]);
+  }
+  return result;
+}
+
+static const char *tsel_query_cache_list_doc =
+    "Return a list describing the compiled queries in the query cache.\n"
+    "Each element is a vector [HASH SOURCE-BYTES USERS PATTERNS] holding the\n"
+    "hash of the query source, its length, the number of live query objects\n"
+    "sharing the compiled query, and its number of patterns.\n"
+    "\n"
+    "(fn)";
+static emacs_value tsel_query_cache_list(emacs_env *env,
+                                         __attribute__((unused)) ptrdiff_t nargs,
+                                         __attribute__((unused)) emacs_value *args,
+                                         __attribute__((unused)) void *data) {
+  emacs_value Qcons = env->intern(env, "cons");
+  emacs_value result = tsel_Qnil;
+  for (int i = 0; i < TSEL_QUERY_CACHE_BUCKETS; i++) {
+    for (TSElQueryCacheEntry *entry = tsel_query_cache[i]; entry; entry = entry->next) {
+      emacs_value vec = tsel_make_vector(env, 4, tsel_Qnil);
+      // Emacs 26 integers may not hold the whole 64 bit hash
+      env->vec_set(env, vec, 0, env->make_integer(env, (intmax_t) (entry->hash >> 8)));
+      env->vec_set(env, vec, 1, env->make_integer(env, entry->key_length));
+      env->vec_set(env, vec, 2, env->make_integer(env, entry->query->refcount - 1));
+      env->vec_set(env, vec, 3, env->make_integer(env, ts_query_pattern_count(entry->query->query)));
+      emacs_value cons_args[2] = {vec, result};
+      result = env->funcall(env, Qcons, 2, cons_args);
+      if (tsel_pending_nonlocal_exit(env)) {
+        return tsel_Qnil;
+      }
+    }
+  }
+  return result;
+}
+
+static const char *tsel_query_cache_flush_doc =
+    "Remove every compiled query from the query cache.\n"
+    "Query objects already created keep working. Returns the number of\n"
+    "entries removed. The cache also drops its least recently used entry\n"
+    "by itself once it holds 128 queries.\n"
+    "\n"
+    "(fn)";
+static emacs_value tsel_query_cache_flush(emacs_env *env,
+                                          __attribute__((unused)) ptrdiff_t nargs,
+                                          __attribute__((unused)) emacs_value *args,
+                                          __attribute__((unused)) void *data) {
+  intmax_t count = 0;
+  for (int i = 0; i < TSEL_QUERY_CACHE_BUCKETS; i++) {
+    TSElQueryCacheEntry *entry = tsel_query_cache[i];
+    while (entry) {
+      TSElQueryCacheEntry *next = entry->next;
+      tsel_query_cache_entry_free(entry);
+      count++;
+      entry = next;
+    }
+    tsel_query_cache[i] = NULL;
+  }
+  tsel_query_cache_count = 0;
+  tsel_query_free_dead_refs(env);
+  return env->make_integer(env, count);
 }
 
 static const char *tsel_query_capture_count_doc =
@@ -195,6 +822,109 @@ tsel_query_start_byte_for_pattern(emacs_env *env,
   return env->make_integer(env,byte+1);
 }
 
+static const char *tsel_query_pattern_symbols_doc =
+    "Return the node types pattern PATTERN-ID in QUERY can match.\n"
+    "The result is a list of node type symbols as returned by\n"
+    "`tree-sitter-node-type', read from the source of the pattern when the\n"
+    "query was compiled. It is t if the pattern can match any node, for\n"
+    "example through a wildcard.\n"
+    "\n"
+    "(fn QUERY PATTERN-ID)";
+static emacs_value tsel_query_pattern_symbols(emacs_env *env,
+                                              __attribute__((unused)) ptrdiff_t nargs,
+                                              emacs_value *args,
+                                              __attribute__((unused)) void *data) {
+  TSElQuery *q;
+  intmax_t pattern;
+  TSEL_SUBR_EXTRACT(query, env, args[0], &q);
+  TSEL_SUBR_EXTRACT(integer, env, args[1], &pattern);
+  if (pattern < 0 || pattern >= ts_query_pattern_count(q->query)) {
+    tsel_signal_error(env, "Pattern index out of range.");
+    return tsel_Qnil;
+  }
+  if (q->pattern_any[pattern]) {
+    return tsel_Qt;
+  }
+  TSElLanguageCache *cache = tsel_language_cache(q->language);
+  if (!cache) {
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  const TSElSymbolSet *set = &q->pattern_symbols[pattern];
+  emacs_value Qcons = env->intern(env, "cons");
+  emacs_value result = tsel_Qnil;
+  for (uint32_t symbol = set->size; symbol > 0 && !tsel_pending_nonlocal_exit(env); symbol--) {
+    if (tsel_symbol_set_contains(set, symbol - 1)) {
+      emacs_value cell[2] = {tsel_language_type_symbol(env, cache, symbol - 1), result};
+      result = env->funcall(env, Qcons, 2, cell);
+    }
+  }
+  if (tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return result;
+}
+
+static const char *tsel_query_predicates_doc =
+    "Return the predicates of pattern PATTERN-ID in QUERY.\n"
+    "Each predicate is a list whose first element is its name as a symbol,\n"
+    "such as `eq?'. The remaining elements are its arguments: capture names\n"
+    "as symbols and string arguments as strings.\n"
+    "\n"
+    "(fn QUERY PATTERN-ID)";
+static emacs_value tsel_query_predicates(emacs_env *env,
+                                         __attribute__((unused)) ptrdiff_t nargs,
+                                         emacs_value *args,
+                                         __attribute__((unused)) void *data) {
+  TSElQuery *q;
+  intmax_t pattern;
+  TSEL_SUBR_EXTRACT(query, env, args[0], &q);
+  TSEL_SUBR_EXTRACT(integer, env, args[1], &pattern);
+  if (pattern < 0 || pattern >= ts_query_pattern_count(q->query)) {
+    tsel_signal_error(env, "Pattern index out of range.");
+    return tsel_Qnil;
+  }
+  uint32_t length;
+  const TSQueryPredicateStep *steps = ts_query_predicates_for_pattern(q->query, pattern, &length);
+  emacs_value Qlist = env->intern(env, "list");
+  emacs_value *items = malloc((length + 1) * sizeof(emacs_value));
+  emacs_value *predicates = malloc((length + 1) * sizeof(emacs_value));
+  if (!items || !predicates) {
+    free(items);
+    free(predicates);
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  ptrdiff_t item_count = 0, predicate_count = 0;
+  for (uint32_t i = 0; i < length && !tsel_pending_nonlocal_exit(env); i++) {
+    uint32_t len;
+    const char *str;
+    switch (steps[i].type) {
+    case TSQueryPredicateStepTypeDone:
+      predicates[predicate_count++] = env->funcall(env, Qlist, item_count, items);
+      item_count = 0;
+      break;
+    case TSQueryPredicateStepTypeCapture:
+      items[item_count++] = tsel_query_capture_symbol(env, q, steps[i].value_id);
+      break;
+    case TSQueryPredicateStepTypeString:
+      str = ts_query_string_value_for_id(q->query, steps[i].value_id, &len);
+      // The predicate name comes first and is returned as a symbol
+      items[item_count] = item_count == 0 ? tsel_intern_string(env, str, len)
+                                          : env->make_string(env, str, len);
+      item_count++;
+      break;
+    }
+  }
+  emacs_value result = env->funcall(env, Qlist, predicate_count, predicates);
+  free(items);
+  free(predicates);
+  if (tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  return result;
+}
+
 static const char *tsel_query_p_wrapped_doc = "Return t if OBJECT is a tree-sitter-query.\n"
   "\n"
   "(fn QUERY)";
@@ -211,8 +941,26 @@ static emacs_value tsel_query_p_wrapped(emacs_env *env,
 
 bool tsel_query_init(emacs_env *env) {
   bool function_result =
-      tsel_define_function(env, "tree-sitter-query-new", &tsel_query_new, 2, 2,
+      tsel_define_function(env, "tree-sitter-query-new", &tsel_query_new, 2, 3,
                            tsel_query_new_doc, NULL);
+  function_result &=
+      tsel_define_function(env, "tree-sitter-query-predicates", &tsel_query_predicates, 2, 2,
+                           tsel_query_predicates_doc, NULL);
+  function_result &=
+      tsel_define_function(env, "tree-sitter-query-pattern-symbols", &tsel_query_pattern_symbols,
+                           2, 2, tsel_query_pattern_symbols_doc, NULL);
+  function_result &=
+      tsel_define_function(env, "tree-sitter-query-bundle-new", &tsel_query_bundle_new, 2, 2,
+                           tsel_query_bundle_new_doc, NULL);
+  function_result &=
+      tsel_define_function(env, "tree-sitter-query-bundle-members", &tsel_query_bundle_members,
+                           1, 1, tsel_query_bundle_members_doc, NULL);
+  function_result &=
+      tsel_define_function(env, "tree-sitter-query-cache-list", &tsel_query_cache_list, 0, 0,
+                           tsel_query_cache_list_doc, NULL);
+  function_result &=
+      tsel_define_function(env, "tree-sitter-query-cache-flush", &tsel_query_cache_flush, 0, 0,
+                           tsel_query_cache_flush_doc, NULL);
   function_result &=
       tsel_define_function(env, "tree-sitter-query-p", &tsel_query_p_wrapped, 1, 1,
                            tsel_query_p_wrapped_doc, NULL);
@@ -244,6 +992,87 @@ bool tsel_query_init(emacs_env *env) {
   return function_result;
 }
 
+void tsel_query_retain(TSElQuery *query) {
+  if (!query) {
+    return;
+  }
+  query->refcount++;
+}
+
+void tsel_query_release(TSElQuery *query) {
+  if (!query) {
+    return;
+  }
+  if (query->refcount > 0) {
+    query->refcount--;
+  }
+  if (query->refcount == 0) {
+    tsel_query_symbols_free(query);
+    tsel_predicates_free(query->predicates);
+    uint32_t capture_count = ts_query_capture_count(query->query);
+    for (uint32_t i = 0; query->capture_symbols && i < capture_count; i++) {
+      tsel_query_queue_ref(query->capture_symbols[i]);
+    }
+    for (uint32_t i = 0; query->member_names && i < query->member_count; i++) {
+      tsel_query_queue_ref(query->member_names[i]);
+    }
+    ts_query_delete(query->query);
+    free(query->capture_symbols);
+    free(query->member_names);
+    free(query->pattern_members);
+    for (uint32_t i = 0; i < query->pool_count; i++) {
+      ts_query_cursor_delete(query->pool[i]);
+    }
+    free(query);
+  }
+}
+
+TSQueryCursor *tsel_query_cursor_take(TSElQuery *query) {
+  // Pooled cursors come back with their range and match limit reset,
+  // so they behave like new ones
+  if (query->pool_count > 0) {
+    return query->pool[--query->pool_count];
+  }
+  return ts_query_cursor_new();
+}
+
+void tsel_query_cursor_return(TSElQuery *query, TSQueryCursor *cursor) {
+  if (!cursor) {
+    return;
+  }
+  if (query->pool_count == TSEL_QUERY_POOL_SIZE) {
+    ts_query_cursor_delete(cursor);
+    return;
+  }
+  ts_query_cursor_set_byte_range(cursor, 0, UINT32_MAX);
+  ts_query_cursor_set_match_limit(cursor, UINT32_MAX);
+  query->pool[query->pool_count++] = cursor;
+}
+
+emacs_value tsel_query_capture_symbol(emacs_env *env, TSElQuery *query, uint32_t index) {
+  tsel_query_free_dead_refs(env);
+  uint32_t count = ts_query_capture_count(query->query);
+  if (index >= count) {
+    return tsel_Qnil;
+  }
+  if (!query->capture_symbols) {
+    query->capture_symbols = calloc(count, sizeof(emacs_value));
+    if (!query->capture_symbols) {
+      return tsel_Qnil;
+    }
+  }
+  if (!query->capture_symbols[index]) {
+    uint32_t len;
+    const char *name = ts_query_capture_name_for_id(query->query, index, &len);
+    emacs_value sym = tsel_intern_string(env, name, len);
+    if (tsel_pending_nonlocal_exit(env)) {
+      return tsel_Qnil;
+    }
+    query->capture_symbols[index] = env->make_global_ref(env, sym);
+  }
+  return query->capture_symbols[index];
+}
+
 bool tsel_query_p(emacs_env *env, emacs_value obj) {
   if (!tsel_check_record_type(env, "tree-sitter-query", obj, 1)) {
     return false;
@@ -23,11 +23,50 @@
 #include <stdbool.h>
 #include <emacs-module.h>
 #include "tree_sitter/api.h"
+#include "predicate.h"
+#include "symbol.h"
+
+// Idle cursors kept per query for reuse
+#define TSEL_QUERY_POOL_SIZE 4
+
 typedef struct TSElQuery{
+  uintptr_t refcount;
   TSQuery * query;
+  // Interned capture names indexed by capture id, filled on first use
+  emacs_value *capture_symbols;
+  // Parsed text predicates, or NULL if no pattern has any
+  TSElPredicates *predicates;
+  // Bundle members and the member each pattern came from, when the
+  // query was built by tree-sitter-query-bundle-new
+  uint32_t member_count;
+  emacs_value *member_names;
+  uint32_t *pattern_members;
+  // Node types each pattern can match, read from the query source.
+  // Patterns which can match any node set pattern_any instead.
+  const TSLanguage *language;
+  TSElSymbolSet *pattern_symbols;
+  bool *pattern_any;
+  // Union over all patterns
+  TSElSymbolSet symbols;
+  bool symbols_any;
+  // Cursors returned by tsel_query_cursor_return, ready for reuse
+  TSQueryCursor *pool[TSEL_QUERY_POOL_SIZE];
+  uint32_t pool_count;
 }TSElQuery;
 
 bool tsel_query_init(emacs_env *env);
+TSElQuery *tsel_query_compile(emacs_env *env, const TSLanguage *language,
+                              const char *source, size_t length);
+TSElQuery *tsel_query_cache_get(const TSLanguage *language, const char *key, size_t length);
+void tsel_query_cache_put(const TSLanguage *language, const char *key, size_t length,
+                          TSElQuery *query);
+emacs_value tsel_query_emacs_move(emacs_env *env, TSElQuery *query);
+void tsel_query_retain(TSElQuery *query);
+void tsel_query_release(TSElQuery *query);
+bool tsel_query_symbol_relevant(const TSElQuery *query, TSSymbol symbol);
+TSQueryCursor *tsel_query_cursor_take(TSElQuery *query);
+void tsel_query_cursor_return(TSElQuery *query, TSQueryCursor *cursor);
+emacs_value tsel_query_capture_symbol(emacs_env *env, TSElQuery *query, uint32_t index);
 bool tsel_query_p(emacs_env *env, emacs_value obj);
 bool tsel_extract_query(emacs_env *env, emacs_value obj,TSElQuery** query);
 
@@ -17,6 +17,7 @@
  * along with tree-sitter.el. If not, see
  * <https://www.gnu.org/licenses/>.
  */
+#include <stdlib.h>
 #include "symbol.h"
 #include "common.h"
 
@@ -88,3 +89,41 @@ bool tsel_symbol_create(emacs_env *env, TSSymbol code, emacs_value *obj_out) {
   *obj_out = res;
   return true;
 }
+
+bool tsel_symbol_set_init(TSElSymbolSet *set, uint32_t size) {
+  set->size = size;
+  set->bits = calloc(size / 64 + 1, sizeof(uint64_t));
+  return set->bits != NULL;
+}
+
+void tsel_symbol_set_free(TSElSymbolSet *set) {
+  free(set->bits);
+  set->bits = NULL;
+  set->size = 0;
+}
+
+bool tsel_extract_symbol_set(emacs_env *env, emacs_value obj, uint32_t size, TSElSymbolSet *set) {
+  // OBJ is a list of tree-sitter-symbol records
+  if(!tsel_symbol_set_init(set, size)) {
+    tsel_signal_error(env, "Failed to allocate symbol set.");
+    return false;
+  }
+  emacs_value Qcar = env->intern(env, "car");
+  emacs_value Qcdr = env->intern(env, "cdr");
+  emacs_value list = obj;
+  while(env->is_not_nil(env, list)) {
+    emacs_value elem = env->funcall(env, Qcar, 1, &list);
+    TSSymbol symbol;
+    if(tsel_pending_nonlocal_exit(env) || !tsel_extract_tssymbol(env, elem, &symbol)) {
+      tsel_symbol_set_free(set);
+      return false;
+    }
+    tsel_symbol_set_add(set, symbol);
+    list = env->funcall(env, Qcdr, 1, &list);
+    if(tsel_pending_nonlocal_exit(env)) {
+      tsel_symbol_set_free(set);
+      return false;
+    }
+  }
+  return true;
+}
@@ -24,9 +24,28 @@
 #include <emacs-module.h>
 #include "tree_sitter/api.h"
 
+// Bitset over the symbols of a language, for O(1) membership tests
+typedef struct TSElSymbolSet {
+  uint32_t size;
+  uint64_t *bits;
+} TSElSymbolSet;
+
 bool tsel_symbol_init(emacs_env *env);
 bool tsel_symbol_p(emacs_env *env, emacs_value obj);
 bool tsel_extract_tssymbol(emacs_env *env, emacs_value obj, TSSymbol *code_out);
 bool tsel_symbol_create(emacs_env *env, TSSymbol code, emacs_value *obj_out);
+bool tsel_symbol_set_init(TSElSymbolSet *set, uint32_t size);
+void tsel_symbol_set_free(TSElSymbolSet *set);
+bool tsel_extract_symbol_set(emacs_env *env, emacs_value obj, uint32_t size, TSElSymbolSet *set);
+
+static inline void tsel_symbol_set_add(TSElSymbolSet *set, TSSymbol symbol) {
+  if(symbol < set->size) {
+    set->bits[symbol / 64] |= UINT64_C(1) << (symbol % 64);
+  }
+}
+
+static inline bool tsel_symbol_set_contains(const TSElSymbolSet *set, TSSymbol symbol) {
+  return symbol < set->size && ((set->bits[symbol / 64] >> (symbol % 64)) & 1);
+}
 
 #endif //ifndef TSEL_SYMBOL_H
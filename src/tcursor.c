@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2019 Karl Otness
+ *
+ * This file is part of tree-sitter.el.
+ *
+ * tree-sitter.el is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * tree-sitter.el is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tree-sitter.el. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include "tcursor.h"
+#include "common.h"
+#include "node.h"
+#include "field.h"
+#include "language.h"
+
+static void tsel_tcursor_fin(void *ptr) {
+  TSElTreeCursor *cursor = ptr;
+  ts_tree_cursor_delete(&cursor->cursor);
+  tsel_tree_release(cursor->tree);
+  free(cursor);
+}
+
+static emacs_value tsel_tcursor_emacs_move(emacs_env *env, TSTreeCursor cursor, TSElTree *tree) {
+  TSElTreeCursor *wrapper = malloc(sizeof(TSElTreeCursor));
+  if(!wrapper) {
+    ts_tree_cursor_delete(&cursor);
+    tsel_signal_error(env, "Failed to allocate tree cursor.");
+    return tsel_Qnil;
+  }
+  tsel_tree_retain(tree);
+  wrapper->cursor = cursor;
+  wrapper->tree = tree;
+  emacs_value Qts_tree_cursor_create = env->intern(env, "tree-sitter-tree-cursor--create");
+  emacs_value user_ptr = env->make_user_ptr(env, &tsel_tcursor_fin, wrapper);
+  emacs_value func_args[1] = { user_ptr };
+  return env->funcall(env, Qts_tree_cursor_create, 1, func_args);
+}
+
+static const char *tsel_tree_cursor_new_doc = "Create a new tree cursor starting at NODE.\n"
+  "A tree cursor walks a tree without allocating a node for each step.\n"
+  "Only `tree-sitter-tree-cursor-current-node' creates a node.\n"
+  "\n"
+  "(fn NODE)";
+static emacs_value tsel_tree_cursor_new(emacs_env *env,
+                                        __attribute__((unused)) ptrdiff_t nargs,
+                                        emacs_value *args,
+                                        __attribute__((unused)) void *data) {
+  TSElNode *node;
+  TSEL_SUBR_EXTRACT(node, env, args[0], &node);
+  return tsel_tcursor_emacs_move(env, ts_tree_cursor_new(node->node), node->tree);
+}
+
+static const char *tsel_tree_cursor_p_wrapped_doc = "Return t if OBJECT is a tree-sitter-tree-cursor.\n"
+  "\n"
+  "(fn OBJECT)";
+static emacs_value tsel_tree_cursor_p_wrapped(emacs_env *env,
+                                              __attribute__((unused)) ptrdiff_t nargs,
+                                              emacs_value *args,
+                                              __attribute__((unused)) void *data) {
+  if(tsel_tcursor_p(env, args[0])) {
+    return tsel_Qt;
+  }
+  return tsel_Qnil;
+}
+
+static const char *tsel_tree_cursor_reset_doc = "Move CURSOR to start at NODE.\n"
+  "NODE may belong to a different tree than the one CURSOR was walking.\n"
+  "\n"
+  "(fn CURSOR NODE)";
+static emacs_value tsel_tree_cursor_reset(emacs_env *env,
+                                          __attribute__((unused)) ptrdiff_t nargs,
+                                          emacs_value *args,
+                                          __attribute__((unused)) void *data) {
+  TSElTreeCursor *cursor;
+  TSElNode *node;
+  TSEL_SUBR_EXTRACT(tcursor, env, args[0], &cursor);
+  TSEL_SUBR_EXTRACT(node, env, args[1], &node);
+  tsel_tree_retain(node->tree);
+  tsel_tree_release(cursor->tree);
+  cursor->tree = node->tree;
+  ts_tree_cursor_reset(&cursor->cursor, node->node);
+  return tsel_Qnil;
+}
+
+static const char *tsel_tree_cursor_copy_doc = "Return a copy of CURSOR at the same position.\n"
+  "\n"
+  "(fn CURSOR)";
+static emacs_value tsel_tree_cursor_copy(emacs_env *env,
+                                         __attribute__((unused)) ptrdiff_t nargs,
+                                         emacs_value *args,
+                                         __attribute__((unused)) void *data) {
+  TSElTreeCursor *cursor;
+  TSEL_SUBR_EXTRACT(tcursor, env, args[0], &cursor);
+  return tsel_tcursor_emacs_move(env, ts_tree_cursor_copy(&cursor->cursor), cursor->tree);
+}
+
+static const char *tsel_tree_cursor_current_node_doc = "Return the node CURSOR is on.\n"
+  "\n"
+  "(fn CURSOR)";
+static emacs_value tsel_tree_cursor_current_node(emacs_env *env,
+                                                 __attribute__((unused)) ptrdiff_t nargs,
+                                                 emacs_value *args,
+                                                 __attribute__((unused)) void *data) {
+  TSElTreeCursor *cursor;
+  TSEL_SUBR_EXTRACT(tcursor, env, args[0], &cursor);
+  TSNode node = ts_tree_cursor_current_node(&cursor->cursor);
+  return tsel_node_emacs_move(env, node, cursor->tree);
+}
+
+static const char *tsel_tree_cursor_current_field_doc = "Return the field of the node CURSOR is on.\n"
+  "The field is a tree-sitter-field record, or nil if the node has no field\n"
+  "in its parent.\n"
+  "\n"
+  "(fn CURSOR)";
+static emacs_value tsel_tree_cursor_current_field(emacs_env *env,
+                                                  __attribute__((unused)) ptrdiff_t nargs,
+                                                  emacs_value *args,
+                                                  __attribute__((unused)) void *data) {
+  TSElTreeCursor *cursor;
+  TSEL_SUBR_EXTRACT(tcursor, env, args[0], &cursor);
+  return tsel_field_emacs_move(env, ts_tree_cursor_current_field_id(&cursor->cursor));
+}
+
+static const char *tsel_tree_cursor_current_field_name_doc = "Return the field name of the node CURSOR is on.\n"
+  "The name is an interned symbol, the same one accepted by\n"
+  "`tree-sitter-node-child-by-field', or nil if the node has no field.\n"
+  "\n"
+  "(fn CURSOR)";
+static emacs_value tsel_tree_cursor_current_field_name(emacs_env *env,
+                                                       __attribute__((unused)) ptrdiff_t nargs,
+                                                       emacs_value *args,
+                                                       __attribute__((unused)) void *data) {
+  TSElTreeCursor *cursor;
+  TSEL_SUBR_EXTRACT(tcursor, env, args[0], &cursor);
+  TSFieldId field = ts_tree_cursor_current_field_id(&cursor->cursor);
+  if(field == 0) {
+    return tsel_Qnil;
+  }
+  TSElLanguageCache *cache = tsel_language_cache(ts_tree_language(cursor->tree->tree));
+  if(!cache) {
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  return tsel_language_field_symbol(env, cache, field);
+}
+
+static bool (*tsel_tree_cursor_movements[3]) (TSTreeCursor *) = {&ts_tree_cursor_goto_parent, &ts_tree_cursor_goto_next_sibling, &ts_tree_cursor_goto_first_child};
+
+static emacs_value tsel_tree_cursor_goto(emacs_env *env,
+                                         __attribute__((unused)) ptrdiff_t nargs,
+                                         emacs_value *args,
+                                         void *data) {
+  bool (**tsel_tree_cursor_movement) (TSTreeCursor *) = data;
+  TSElTreeCursor *cursor;
+  TSEL_SUBR_EXTRACT(tcursor, env, args[0], &cursor);
+  if((*tsel_tree_cursor_movement)(&cursor->cursor)) {
+    return tsel_Qt;
+  }
+  return tsel_Qnil;
+}
+
+static const char *tsel_tree_cursor_goto_parent_doc = "Move CURSOR to the parent of its node.\n"
+  "Returns non-nil if the cursor moved. The cursor never moves above the\n"
+  "node it was created or reset with.\n"
+  "\n"
+  "(fn CURSOR)";
+static const char *tsel_tree_cursor_goto_next_sibling_doc = "Move CURSOR to the next sibling of its node.\n"
+  "Returns non-nil if the cursor moved.\n"
+  "\n"
+  "(fn CURSOR)";
+static const char *tsel_tree_cursor_goto_first_child_doc = "Move CURSOR to the first child of its node.\n"
+  "Returns non-nil if the cursor moved.\n"
+  "\n"
+  "(fn CURSOR)";
+
+static const char *tsel_tree_cursor_goto_first_child_for_byte_doc = "Move CURSOR to the first child of its node extending beyond BYTE.\n"
+  "Returns the index of the child moved to, or nil if there is no such\n"
+  "child and the cursor did not move.\n"
+  "\n"
+  "(fn CURSOR BYTE)";
+static emacs_value tsel_tree_cursor_goto_first_child_for_byte(emacs_env *env,
+                                                              __attribute__((unused)) ptrdiff_t nargs,
+                                                              emacs_value *args,
+                                                              __attribute__((unused)) void *data) {
+  TSElTreeCursor *cursor;
+  intmax_t byte;
+  TSEL_SUBR_EXTRACT(tcursor, env, args[0], &cursor);
+  TSEL_SUBR_EXTRACT(integer, env, args[1], &byte);
+  int64_t index = ts_tree_cursor_goto_first_child_for_byte(&cursor->cursor, byte - 1);
+  if(index < 0) {
+    return tsel_Qnil;
+  }
+  return env->make_integer(env, index);
+}
+
+bool tsel_tcursor_init(emacs_env *env) {
+  bool function_result = tsel_define_function(env, "tree-sitter-tree-cursor-new",
+                                              &tsel_tree_cursor_new, 1, 1,
+                                              tsel_tree_cursor_new_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-tree-cursor-p",
+                                          &tsel_tree_cursor_p_wrapped, 1, 1,
+                                          tsel_tree_cursor_p_wrapped_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-tree-cursor-reset",
+                                          &tsel_tree_cursor_reset, 2, 2,
+                                          tsel_tree_cursor_reset_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-tree-cursor-copy",
+                                          &tsel_tree_cursor_copy, 1, 1,
+                                          tsel_tree_cursor_copy_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-tree-cursor-current-node",
+                                          &tsel_tree_cursor_current_node, 1, 1,
+                                          tsel_tree_cursor_current_node_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-tree-cursor-current-field",
+                                          &tsel_tree_cursor_current_field, 1, 1,
+                                          tsel_tree_cursor_current_field_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-tree-cursor-current-field-name",
+                                          &tsel_tree_cursor_current_field_name, 1, 1,
+                                          tsel_tree_cursor_current_field_name_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-tree-cursor-goto-parent",
+                                          &tsel_tree_cursor_goto, 1, 1,
+                                          tsel_tree_cursor_goto_parent_doc, &tsel_tree_cursor_movements[0]);
+  function_result &= tsel_define_function(env, "tree-sitter-tree-cursor-goto-next-sibling",
+                                          &tsel_tree_cursor_goto, 1, 1,
+                                          tsel_tree_cursor_goto_next_sibling_doc, &tsel_tree_cursor_movements[1]);
+  function_result &= tsel_define_function(env, "tree-sitter-tree-cursor-goto-first-child",
+                                          &tsel_tree_cursor_goto, 1, 1,
+                                          tsel_tree_cursor_goto_first_child_doc, &tsel_tree_cursor_movements[2]);
+  function_result &= tsel_define_function(env, "tree-sitter-tree-cursor-goto-first-child-for-byte",
+                                          &tsel_tree_cursor_goto_first_child_for_byte, 2, 2,
+                                          tsel_tree_cursor_goto_first_child_for_byte_doc, NULL);
+  return function_result;
+}
+
+bool tsel_tcursor_p(emacs_env *env, emacs_value obj) {
+  if(!tsel_check_record_type(env, "tree-sitter-tree-cursor", obj, 1)) {
+    return false;
+  }
+  // Get the ptr field
+  emacs_value user_ptr;
+  if(!tsel_record_get_field(env, obj, 1, &user_ptr)) {
+    return false;
+  }
+  // Make sure it's a user pointer
+  emacs_value Quser_ptrp = env->intern(env, "user-ptrp");
+  emacs_value args[1] = { user_ptr };
+  if(!env->eq(env, env->funcall(env, Quser_ptrp, 1, args), tsel_Qt) ||
+     tsel_pending_nonlocal_exit(env)) {
+    return false;
+  }
+  // Check the finalizer
+  emacs_finalizer *fin = env->get_user_finalizer(env, user_ptr);
+  return !tsel_pending_nonlocal_exit(env) && fin == &tsel_tcursor_fin;
+}
+
+bool tsel_extract_tcursor(emacs_env *env, emacs_value obj, TSElTreeCursor **cursor) {
+  if(!tsel_tcursor_p(env, obj)) {
+    tsel_signal_wrong_type(env, "tree-sitter-tree-cursor-p", obj);
+    return false;
+  }
+  // Get the ptr field
+  emacs_value user_ptr;
+  if(!tsel_record_get_field(env, obj, 1, &user_ptr)) {
+    return false;
+  }
+  // Get the raw pointer
+  TSElTreeCursor *ptr = env->get_user_ptr(env, user_ptr);
+  if(tsel_pending_nonlocal_exit(env)) {
+    return false;
+  }
+  *cursor = ptr;
+  return true;
+}
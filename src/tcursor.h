@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2019 Karl Otness
+ *
+ * This file is part of tree-sitter.el.
+ *
+ * tree-sitter.el is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * tree-sitter.el is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tree-sitter.el. If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#ifndef TSEL_TCURSOR_H
+#define TSEL_TCURSOR_H
+#include <stdbool.h>
+#include <emacs-module.h>
+#include "tree_sitter/api.h"
+#include "tree.h"
+
+typedef struct TSElTreeCursor {
+  TSTreeCursor cursor;
+  TSElTree *tree;
+} TSElTreeCursor;
+
+bool tsel_tcursor_init(emacs_env *env);
+bool tsel_tcursor_p(emacs_env *env, emacs_value obj);
+bool tsel_extract_tcursor(emacs_env *env, emacs_value obj, TSElTreeCursor **cursor);
+
+#endif //ifndef TSEL_TCURSOR_H
@@ -17,7 +17,11 @@
  * along with tree-sitter.el. If not, see
  * <https://www.gnu.org/licenses/>.
  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "tree.h"
+#include "alloc.h"
 #include "common.h"
 #include "node.h"
 #include "point.h"
@@ -67,6 +71,26 @@ static emacs_value tsel_tree_copy(emacs_env *env,
   return tsel_tree_emacs_move(env, new_tree);
 }
 
+static bool tsel_tree_merge_edit(TSElTree *tree, const TSInputEdit *edit) {
+  // An edit replacing text that ends where the new text of the last
+  // edit ends, as typing or deleting backwards does, merges with it.
+  // The merged edit shifts every position the same as the two did.
+  if(tree->edit_count <= tree->edit_sealed) {
+    return false;
+  }
+  TSInputEdit *last = &tree->edits[tree->edit_count - 1];
+  if(edit->old_end_byte != last->new_end_byte || edit->start_byte > last->new_end_byte) {
+    return false;
+  }
+  if(edit->start_byte < last->start_byte) {
+    last->start_byte = edit->start_byte;
+    last->start_point = edit->start_point;
+  }
+  last->new_end_byte = edit->new_end_byte;
+  last->new_end_point = edit->new_end_point;
+  return true;
+}
+
 static const char *tsel_tree_edit_doc = "Mark a portion of TREE as edited.\n"
   "\n"
   "(fn TREE START-BYTE OLD-END-BYTE NEW-END-BYTE START-POINT OLD-END-POINT NEW-END-POINT)";
@@ -87,12 +111,77 @@ static emacs_value tsel_tree_edit(emacs_env *env,
   TSEL_SUBR_EXTRACT(point, env, args[4], &edit.start_point);
   TSEL_SUBR_EXTRACT(point, env, args[5], &edit.old_end_point);
   TSEL_SUBR_EXTRACT(point, env, args[6], &edit.new_end_point);
+  // Query results computed on this tree replay the log to shift their
+  // positions, and tree-sitter-query-changes-relevant-p reads all of
+  // it, see src/qresult.c
+  if(!tsel_tree_merge_edit(tree, &edit)) {
+    if(tree->edit_count == tree->edit_capacity) {
+      uint32_t capacity = tree->edit_capacity ? tree->edit_capacity * 2 : 8;
+      TSInputEdit *edits = realloc(tree->edits, capacity * sizeof(TSInputEdit));
+      if(!edits) {
+        tsel_signal_error(env, "Allocation failed.");
+        return tsel_Qnil;
+      }
+      tree->edits = edits;
+      tree->edit_capacity = capacity;
+    }
+    tree->edits[tree->edit_count++] = edit;
+  }
   // Signal the edit
   ts_tree_edit(tree->tree, &edit);
   tree->dirty = true;
+  if(tree->finger) {
+    // The cached nodes hold positions from before the edit
+    tree->finger->depth = 0;
+  }
   return tsel_Qt;
 }
 
+static const char *tsel_tree_node_at_doc = "Return the smallest node of TREE containing BYTE.\n"
+  "This is the node `tree-sitter-node-descendant-for-byte-range' finds from\n"
+  "the root for a zero-width range at BYTE. If TYPE is the symbol 'named\n"
+  "only named nodes are returned.\n"
+  "TREE remembers the path to the last node returned, and the next lookup\n"
+  "climbs only as far as needed from there, so repeated lookups near the\n"
+  "same position are cheap. The path is dropped when TREE is edited.\n"
+  "\n"
+  "(fn TREE BYTE &optional TYPE)";
+static emacs_value tsel_tree_node_at(emacs_env *env,
+                                     ptrdiff_t nargs,
+                                     emacs_value *args,
+                                     __attribute__((unused)) void *data) {
+  TSElTree *tree;
+  intmax_t byte;
+  TSEL_SUBR_EXTRACT(tree, env, args[0], &tree);
+  TSEL_SUBR_EXTRACT(integer, env, args[1], &byte);
+  bool named = nargs > 2 && env->eq(env, args[2], env->intern(env, "named"));
+  if(!tree->finger) {
+    tree->finger = calloc(1, sizeof(TSElNodePath));
+    if(!tree->finger) {
+      tsel_signal_error(env, "Allocation failed.");
+      return tsel_Qnil;
+    }
+  }
+  TSElNodePath *finger = tree->finger;
+  if(finger->depth == 0 &&
+     !tsel_node_path_push(finger, ts_tree_root_node(tree->tree))) {
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  if(!tsel_node_path_seek(finger, byte - 1)) {
+    finger->depth = 0;
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  uint32_t depth = finger->depth;
+  if(named) {
+    while(depth > 1 && !ts_node_is_named(finger->nodes[depth - 1])) {
+      depth--;
+    }
+  }
+  return tsel_node_emacs_move(env, finger->nodes[depth - 1], tree);
+}
+
 static const char *tsel_tree_changed_ranges_doc = "Return a list of changed ranges between TREE-A and TREE-B.\n"
   "\n"
   "(fn TREE-A TREE-B)";
@@ -125,10 +214,317 @@ static emacs_value tsel_tree_changed_ranges(emacs_env *env,
       return tsel_Qnil;
     }
   }
-  free(ptr);
+  tsel_ts_free(ptr);
   return list;
 }
 
+/*
+ * Tree export format. All integers are little-endian.
+ *
+ *   0  "TSELTREE"
+ *   8  u32 format version (1)
+ *  12  u32 node count N
+ *  16  u32 symbol count of the tree's language
+ *  20  12 reserved bytes
+ *  32  arrays of N elements, in this order, each padded to 8 bytes:
+ *      u32 start byte, u32 end byte, u32 start row, u32 start column,
+ *      u32 parent index, u16 symbol, u16 field, u8 flags
+ *
+ * Nodes are stored in preorder. Bytes, rows and columns are zero-based,
+ * as in tree-sitter. The root's parent index is 0xFFFFFFFF.
+ */
+#define TSEL_EXPORT_VERSION 1
+#define TSEL_EXPORT_HEADER_SIZE 32
+#define TSEL_EXPORT_NO_PARENT UINT32_MAX
+#define TSEL_EXPORT_NAMED 1
+#define TSEL_EXPORT_EXTRA 2
+#define TSEL_EXPORT_ERROR 4
+#define TSEL_EXPORT_MISSING 8
+#define TSEL_EXPORT_HAS_ERROR 16
+
+typedef struct tsel_tree_export {
+  uint32_t count;
+  uint32_t capacity;
+  uint32_t *u32[5];
+  uint16_t *symbol;
+  uint16_t *field;
+  uint8_t *flags;
+} tsel_tree_export;
+
+static void tsel_tree_export_free(tsel_tree_export *exp) {
+  for(int i = 0; i < 5; i++) {
+    free(exp->u32[i]);
+  }
+  free(exp->symbol);
+  free(exp->field);
+  free(exp->flags);
+}
+
+static bool tsel_tree_export_grow(tsel_tree_export *exp) {
+  uint32_t capacity = exp->capacity ? exp->capacity * 2 : 1024;
+  for(int i = 0; i < 5; i++) {
+    uint32_t *arr = realloc(exp->u32[i], capacity * sizeof(uint32_t));
+    if(!arr) {
+      return false;
+    }
+    exp->u32[i] = arr;
+  }
+  uint16_t *symbol = realloc(exp->symbol, capacity * sizeof(uint16_t));
+  if(symbol) {
+    exp->symbol = symbol;
+  }
+  uint16_t *field = realloc(exp->field, capacity * sizeof(uint16_t));
+  if(field) {
+    exp->field = field;
+  }
+  uint8_t *flags = realloc(exp->flags, capacity);
+  if(flags) {
+    exp->flags = flags;
+  }
+  if(!symbol || !field || !flags) {
+    return false;
+  }
+  exp->capacity = capacity;
+  return true;
+}
+
+static bool tsel_tree_export_collect(TSNode root, tsel_tree_export *exp) {
+  // Index of the enclosing node at each depth of the walk
+  uint32_t depth = 0, stack_size = 64;
+  uint32_t *parents = malloc(stack_size * sizeof(uint32_t));
+  if(!parents) {
+    return false;
+  }
+  TSTreeCursor cursor = ts_tree_cursor_new(root);
+  bool ok = true;
+  while(ok) {
+    if(exp->count == exp->capacity && !tsel_tree_export_grow(exp)) {
+      ok = false;
+      break;
+    }
+    TSNode node = ts_tree_cursor_current_node(&cursor);
+    TSPoint start = ts_node_start_point(node);
+    uint32_t index = exp->count++;
+    exp->u32[0][index] = ts_node_start_byte(node);
+    exp->u32[1][index] = ts_node_end_byte(node);
+    exp->u32[2][index] = start.row;
+    exp->u32[3][index] = start.column;
+    exp->u32[4][index] = depth > 0 ? parents[depth - 1] : TSEL_EXPORT_NO_PARENT;
+    exp->symbol[index] = ts_node_symbol(node);
+    exp->field[index] = ts_tree_cursor_current_field_id(&cursor);
+    exp->flags[index] = (ts_node_is_named(node) ? TSEL_EXPORT_NAMED : 0) |
+      (ts_node_is_extra(node) ? TSEL_EXPORT_EXTRA : 0) |
+      (ts_node_symbol(node) == (TSSymbol) -1 ? TSEL_EXPORT_ERROR : 0) |
+      (ts_node_is_missing(node) ? TSEL_EXPORT_MISSING : 0) |
+      (ts_node_has_error(node) ? TSEL_EXPORT_HAS_ERROR : 0);
+    // Advance in preorder
+    if(ts_tree_cursor_goto_first_child(&cursor)) {
+      if(depth == stack_size) {
+        uint32_t *grown = realloc(parents, stack_size * 2 * sizeof(uint32_t));
+        if(!grown) {
+          ok = false;
+          break;
+        }
+        parents = grown;
+        stack_size *= 2;
+      }
+      parents[depth++] = index;
+      continue;
+    }
+    while(!ts_tree_cursor_goto_next_sibling(&cursor)) {
+      if(depth == 0 || !ts_tree_cursor_goto_parent(&cursor)) {
+        depth = 0;
+        break;
+      }
+      depth--;
+    }
+    if(depth == 0) {
+      break;
+    }
+  }
+  ts_tree_cursor_delete(&cursor);
+  free(parents);
+  return ok;
+}
+
+static size_t tsel_tree_export_padded(size_t size) {
+  return (size + 7) & ~((size_t) 7);
+}
+
+static uint8_t *tsel_tree_export_put(uint8_t *out, uint64_t value, int size) {
+  for(int i = 0; i < size; i++) {
+    out[i] = (value >> (8 * i)) & 0xff;
+  }
+  return out + size;
+}
+
+static bool tsel_tree_export_write(const tsel_tree_export *exp, uint32_t symbol_count, FILE *file) {
+  size_t n = exp->count;
+  size_t total = TSEL_EXPORT_HEADER_SIZE + 5 * tsel_tree_export_padded(4 * n) +
+    2 * tsel_tree_export_padded(2 * n) + tsel_tree_export_padded(n);
+  uint8_t *data = calloc(total, 1);
+  if(!data) {
+    return false;
+  }
+  memcpy(data, "TSELTREE", 8);
+  tsel_tree_export_put(data + 8, TSEL_EXPORT_VERSION, 4);
+  tsel_tree_export_put(data + 12, n, 4);
+  tsel_tree_export_put(data + 16, symbol_count, 4);
+  uint8_t *out = data + TSEL_EXPORT_HEADER_SIZE;
+  for(int a = 0; a < 5; a++) {
+    for(size_t i = 0; i < n; i++) {
+      tsel_tree_export_put(out + 4 * i, exp->u32[a][i], 4);
+    }
+    out += tsel_tree_export_padded(4 * n);
+  }
+  for(size_t i = 0; i < n; i++) {
+    tsel_tree_export_put(out + 2 * i, exp->symbol[i], 2);
+  }
+  out += tsel_tree_export_padded(2 * n);
+  for(size_t i = 0; i < n; i++) {
+    tsel_tree_export_put(out + 2 * i, exp->field[i], 2);
+  }
+  out += tsel_tree_export_padded(2 * n);
+  memcpy(out, exp->flags, n);
+  bool ok = fwrite(data, 1, total, file) == total;
+  free(data);
+  return ok;
+}
+
+static const char *tsel_tree_export_file_doc = "Write a packed dump of every node in TREE to FILE.\n"
+  "FILE must be an absolute file name. Nodes are written in preorder as a\n"
+  "struct of arrays, see `tree-sitter-tree-export' for the layout.\n"
+  "Returns the number of nodes written.\n"
+  "\n"
+  "(fn TREE FILE)";
+static emacs_value tsel_tree_export_file(emacs_env *env,
+                                         __attribute__((unused)) ptrdiff_t nargs,
+                                         emacs_value *args,
+                                         __attribute__((unused)) void *data) {
+  TSElTree *tree;
+  char *file_name;
+  TSEL_SUBR_EXTRACT(tree, env, args[0], &tree);
+  TSEL_SUBR_EXTRACT(string, env, args[1], &file_name);
+  tsel_tree_export exp = {0};
+  if(!tsel_tree_export_collect(ts_tree_root_node(tree->tree), &exp)) {
+    tsel_tree_export_free(&exp);
+    free(file_name);
+    tsel_signal_error(env, "Failed to allocate tree export.");
+    return tsel_Qnil;
+  }
+  FILE *file = fopen(file_name, "wb");
+  free(file_name);
+  bool written = file &&
+    tsel_tree_export_write(&exp, ts_language_symbol_count(ts_tree_language(tree->tree)), file);
+  if(file && fclose(file) != 0) {
+    written = false;
+  }
+  uint32_t count = exp.count;
+  tsel_tree_export_free(&exp);
+  if(!written) {
+    tsel_signal_error(env, "Failed to write tree export.");
+    return tsel_Qnil;
+  }
+  return env->make_integer(env, count);
+}
+
+typedef struct tsel_tree_stats {
+  uintmax_t nodes;
+  uintmax_t named;
+  uintmax_t errors;
+  uintmax_t missing;
+  uintmax_t leaf_bytes;
+  uintmax_t depth_sum;
+  uint32_t max_depth;
+  uint32_t symbol_count;
+  uintmax_t *histogram;
+} tsel_tree_stats;
+
+static void tsel_tree_stats_collect(TSNode root, tsel_tree_stats *stats) {
+  TSTreeCursor cursor = ts_tree_cursor_new(root);
+  uint32_t depth = 0;
+  while(true) {
+    TSNode node = ts_tree_cursor_current_node(&cursor);
+    TSSymbol symbol = ts_node_symbol(node);
+    stats->nodes++;
+    stats->depth_sum += depth;
+    if(depth > stats->max_depth) {
+      stats->max_depth = depth;
+    }
+    if(ts_node_is_named(node)) {
+      stats->named++;
+    }
+    if(ts_node_is_missing(node)) {
+      stats->missing++;
+    }
+    if(symbol == (TSSymbol) -1) {
+      stats->errors++;
+    }
+    else if(symbol < stats->symbol_count) {
+      stats->histogram[symbol]++;
+    }
+    if(ts_tree_cursor_goto_first_child(&cursor)) {
+      depth++;
+      continue;
+    }
+    stats->leaf_bytes += ts_node_end_byte(node) - ts_node_start_byte(node);
+    while(!ts_tree_cursor_goto_next_sibling(&cursor)) {
+      if(depth == 0 || !ts_tree_cursor_goto_parent(&cursor)) {
+        ts_tree_cursor_delete(&cursor);
+        return;
+      }
+      depth--;
+    }
+  }
+}
+
+static const char *tsel_tree_stats_doc = "Return a tree-sitter-tree-stats record describing TREE.\n"
+  "The statistics are gathered in a single pass over every node. Read\n"
+  "them with `tree-sitter-tree-stats-node-count',\n"
+  "`tree-sitter-tree-stats-named-count', `tree-sitter-tree-stats-max-depth',\n"
+  "`tree-sitter-tree-stats-average-depth', `tree-sitter-tree-stats-histogram',\n"
+  "`tree-sitter-tree-stats-error-count', `tree-sitter-tree-stats-missing-count'\n"
+  "and `tree-sitter-tree-stats-leaf-bytes'.\n"
+  "\n"
+  "(fn TREE)";
+static emacs_value tsel_tree_stats_wrapped(emacs_env *env,
+                                           __attribute__((unused)) ptrdiff_t nargs,
+                                           emacs_value *args,
+                                           __attribute__((unused)) void *data) {
+  TSElTree *tree;
+  TSEL_SUBR_EXTRACT(tree, env, args[0], &tree);
+  tsel_tree_stats stats = {0};
+  stats.symbol_count = ts_language_symbol_count(ts_tree_language(tree->tree));
+  stats.histogram = calloc(stats.symbol_count + 1, sizeof(uintmax_t));
+  if(!stats.histogram) {
+    tsel_signal_error(env, "Allocation failed.");
+    return tsel_Qnil;
+  }
+  tsel_tree_stats_collect(ts_tree_root_node(tree->tree), &stats);
+  emacs_value histogram = tsel_make_vector(env, stats.symbol_count, env->make_integer(env, 0));
+  for(uint32_t i = 0; i < stats.symbol_count; i++) {
+    if(stats.histogram[i]) {
+      env->vec_set(env, histogram, i, env->make_integer(env, stats.histogram[i]));
+    }
+  }
+  free(stats.histogram);
+  emacs_value func_args[8] = {
+    env->make_integer(env, stats.nodes),
+    env->make_integer(env, stats.named),
+    env->make_integer(env, stats.max_depth),
+    env->make_float(env, stats.nodes ? (double) stats.depth_sum / stats.nodes : 0.0),
+    histogram,
+    env->make_integer(env, stats.errors),
+    env->make_integer(env, stats.missing),
+    env->make_integer(env, stats.leaf_bytes),
+  };
+  if(tsel_pending_nonlocal_exit(env)) {
+    return tsel_Qnil;
+  }
+  emacs_value Qts_tree_stats_create = env->intern(env, "tree-sitter-tree-stats--create");
+  return env->funcall(env, Qts_tree_stats_create, 8, func_args);
+}
+
 bool tsel_tree_init(emacs_env *env) {
   bool function_result = tsel_define_function(env, "tree-sitter-tree-p",
                                               &tsel_tree_p_wrapped, 1, 1,
@@ -142,25 +538,47 @@ bool tsel_tree_init(emacs_env *env) {
   function_result &= tsel_define_function(env, "tree-sitter-tree-edit",
                                           &tsel_tree_edit, 7, 7,
                                           tsel_tree_edit_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-tree-node-at",
+                                          &tsel_tree_node_at, 2, 3,
+                                          tsel_tree_node_at_doc, NULL);
   function_result &= tsel_define_function(env, "tree-sitter-tree-changed-ranges",
                                           &tsel_tree_changed_ranges, 2, 2,
                                           tsel_tree_changed_ranges_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-tree-stats",
+                                          &tsel_tree_stats_wrapped, 1, 1,
+                                          tsel_tree_stats_doc, NULL);
+  function_result &= tsel_define_function(env, "tree-sitter-tree-export-file",
+                                          &tsel_tree_export_file, 2, 2,
+                                          tsel_tree_export_file_doc, NULL);
   return function_result;
 }
 
+TSElTree *tsel_tree_wrap(TSTree *tree) {
+  TSElTree *wrapper = malloc(sizeof(TSElTree));
+  if(!wrapper) {
+    return NULL;
+  }
+  wrapper->refcount = 1;
+  wrapper->tree = tree;
+  wrapper->dirty = false;
+  wrapper->finger = NULL;
+  wrapper->edits = NULL;
+  wrapper->edit_count = 0;
+  wrapper->edit_capacity = 0;
+  wrapper->edit_sealed = 0;
+  return wrapper;
+}
+
 emacs_value tsel_tree_emacs_move(emacs_env *env, TSTree *tree) {
   if(!tree) {
     return tsel_Qnil;
   }
-  TSElTree *wrapper = malloc(sizeof(TSElTree));
+  TSElTree *wrapper = tsel_tree_wrap(tree);
   if(!wrapper) {
     ts_tree_delete(tree);
     tsel_signal_error(env, "Failed to allocate tree.");
     return tsel_Qnil;
   }
-  wrapper->refcount = 1;
-  wrapper->tree = tree;
-  wrapper->dirty = false;
   emacs_value Qts_tree_create = env->intern(env, "tree-sitter-tree--create");
   emacs_value user_ptr = env->make_user_ptr(env, &tsel_tree_fin, wrapper);
   emacs_value func_args[1] = { user_ptr };
@@ -186,10 +604,21 @@ void tsel_tree_release(TSElTree *tree) {
     if(tree->tree) {
       ts_tree_delete(tree->tree);
     }
+    if(tree->finger) {
+      tsel_node_path_free(tree->finger);
+      free(tree->finger);
+    }
+    free(tree->edits);
     free(tree);
   }
 }
 
+uint32_t tsel_tree_mark_edits(TSElTree *tree) {
+  // Later edits must not be merged into the ones before the mark
+  tree->edit_sealed = tree->edit_count;
+  return tree->edit_count;
+}
+
 bool tsel_tree_p(emacs_env *env, emacs_value obj) {
   if(!tsel_check_record_type(env, "tree-sitter-tree", obj, 1)) {
     return false;
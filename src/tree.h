@@ -24,16 +24,29 @@
 #include <emacs-module.h>
 #include "tree_sitter/api.h"
 
+struct TSElNodePath;
+
 typedef struct TSElTree {
   uintptr_t refcount;
   TSTree *tree;
   bool dirty;
+  // Path of the last tree-sitter-tree-node-at lookup, or NULL
+  struct TSElNodePath *finger;
+  // Every edit applied to this tree, in order, with runs of typing or
+  // deleting merged into one edit
+  TSInputEdit *edits;
+  uint32_t edit_count;
+  uint32_t edit_capacity;
+  // Edits a query result has marked, which are never merged into
+  uint32_t edit_sealed;
 } TSElTree;
 
 bool tsel_tree_init(emacs_env *env);
+TSElTree *tsel_tree_wrap(TSTree *tree);
 emacs_value tsel_tree_emacs_move(emacs_env *env, TSTree *tree);
 void tsel_tree_retain(TSElTree *tree);
 void tsel_tree_release(TSElTree *tree);
+uint32_t tsel_tree_mark_edits(TSElTree *tree);
 bool tsel_tree_p(emacs_env *env, emacs_value obj);
 bool tsel_extract_tree(emacs_env *env, emacs_value obj, TSElTree **tree);
 
@@ -0,0 +1,149 @@
+;;; tree-sitter-tests.el --- Tests for tree-sitter.el  -*- lexical-binding: t; -*-
+
+;; Copyright (C) 2019 Karl Otness
+
+;; This file is part of tree-sitter.el.
+
+;; tree-sitter.el is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+
+;; tree-sitter.el is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+;; General Public License for more details.
+
+;; You should have received a copy of the GNU General Public License
+;; along with tree-sitter.el. If not, see
+;; <https://www.gnu.org/licenses/>.
+
+;;; Commentary:
+
+;; Run with "make test" once the module and the C grammar under
+;; langs/c are built.
+
+;;; Code:
+
+(require 'cl-lib)
+(require 'ert)
+(require 'tree-sitter)
+(require 'tree-sitter-lang-c)
+
+(defmacro tree-sitter-tests--with-c (text &rest body)
+  "Run BODY in a buffer holding TEXT, with `tree' bound to its C parse."
+  (declare (indent 1))
+  `(with-temp-buffer
+     (insert ,text)
+     (let* ((parser (tree-sitter-parser-new))
+            (tree (progn
+                    (tree-sitter-parser-set-language parser (tree-sitter-lang-c))
+                    (tree-sitter-parser-parse-buffer parser (current-buffer)))))
+       ,@body)))
+
+(defun tree-sitter-tests--native (tree byte &optional type)
+  "Return the node tree-sitter itself finds in TREE at BYTE for TYPE."
+  (tree-sitter-node-descendant-for-byte-range
+   (tree-sitter-tree-root-node tree) byte byte type))
+
+(ert-deftest tree-sitter-tests-node-at-token-boundary ()
+  "A lookup where one token ends and the next starts finds the next."
+  (tree-sitter-tests--with-c "int x = foo(1);\n"
+    ;; Byte 12 is the ( right after foo
+    (let ((node (tree-sitter-tree-node-at tree 12)))
+      (should (equal (tree-sitter-node-type node) "("))
+      (should (tree-sitter-node-eq node (tree-sitter-tests--native tree 12))))
+    ;; Every byte, both from the cached path and in reverse
+    (dolist (bytes (list (number-sequence 1 16) (number-sequence 16 1 -1)))
+      (dolist (byte bytes)
+        (should (tree-sitter-node-eq (tree-sitter-tree-node-at tree byte)
+                                     (tree-sitter-tests--native tree byte)))
+        (should (tree-sitter-node-eq (tree-sitter-tree-node-at tree byte 'named)
+                                     (tree-sitter-tests--native tree byte 'named)))))))
+
+(ert-deftest tree-sitter-tests-descendants-at-token-boundary ()
+  "Batched lookups agree with tree-sitter where tokens meet."
+  (tree-sitter-tests--with-c "int x = foo(1);\n"
+    (let* ((root (tree-sitter-tree-root-node tree))
+           (bytes (vconcat (number-sequence 16 1 -1) (number-sequence 1 16)))
+           (nodes (tree-sitter-node-descendants-for-bytes root bytes))
+           (named (tree-sitter-node-descendants-for-bytes root bytes 'named)))
+      (dotimes (i (length bytes))
+        (should (tree-sitter-node-eq (aref nodes i)
+                                     (tree-sitter-tests--native tree (aref bytes i))))
+        (should (tree-sitter-node-eq (aref named i)
+                                     (tree-sitter-tests--native tree (aref bytes i) 'named)))))))
+
+(ert-deftest tree-sitter-tests-ancestors-at-token-boundary ()
+  "The path to a byte is the parent chain of tree-sitter's node there."
+  (tree-sitter-tests--with-c "int x = foo(1);\n"
+    (let ((root (tree-sitter-tree-root-node tree)))
+      (dolist (byte (number-sequence 1 16))
+        (let ((path (tree-sitter-node-ancestors root byte))
+              (node (tree-sitter-tests--native tree byte))
+              (parents nil))
+          (while node
+            (push node parents)
+            (setq node (tree-sitter-node-parent node)))
+          (should (= (length path) (length parents)))
+          (cl-loop for a across path
+                   for b in parents
+                   do (should (tree-sitter-node-eq a b))))))))
+
+(ert-deftest tree-sitter-tests-changes-relevant-text-edit ()
+  "Renaming an identifier is relevant to a query on identifiers."
+  (tree-sitter-tests--with-c "int foo;\n"
+    (let ((identifiers (tree-sitter-query-new
+                        (tree-sitter-lang-c) "((identifier) @x (#eq? @x \"foo\"))"))
+          (strings (tree-sitter-query-new (tree-sitter-lang-c) "(string_literal) @s"))
+          (start-point (tree-sitter-position-to-point 5))
+          (old-end-point (tree-sitter-position-to-point 8)))
+      (delete-region 5 8)
+      (goto-char 5)
+      (insert "bar")
+      (tree-sitter-tree-edit tree 5 8 8 start-point old-end-point
+                             (tree-sitter-position-to-point 8))
+      (let ((new-tree (tree-sitter-parser-parse-buffer parser (current-buffer) tree)))
+        (should (tree-sitter-query-changes-relevant-p identifiers tree new-tree))
+        (should-not (tree-sitter-query-changes-relevant-p strings tree new-tree))))))
+
+(ert-deftest tree-sitter-tests-predicate-every-capture ()
+  "A match that passes its predicates returns all of its captures."
+  (tree-sitter-tests--with-c "int x = foo(1);\nint y = bar(2);\n"
+    (let* ((query (tree-sitter-query-new
+                   (tree-sitter-lang-c)
+                   "((call_expression function: (identifier) @f
+                                      arguments: (argument_list) @a)
+                     (#eq? @f \"foo\"))"))
+           (captures (tree-sitter-query-captures
+                      query (tree-sitter-tree-root-node tree))))
+      ;; Four elements per capture: foo and then its (1)
+      (should (= (length captures) 8))
+      (should (equal (list (aref captures 2) (aref captures 3)) '(9 12)))
+      (should (equal (list (aref captures 6) (aref captures 7)) '(12 15))))))
+
+(defun tree-sitter-tests--walk-identifiers (node &rest range)
+  "Return the start bytes of identifiers `tree-sitter-walk' finds in NODE.
+RANGE is the START and END passed on."
+  (let ((found nil))
+    (apply #'tree-sitter-walk node
+           (lambda (nodes)
+             (mapc (lambda (child)
+                     (when (equal (tree-sitter-node-type child) "identifier")
+                       (push (tree-sitter-node-start-byte child) found)))
+                   nodes))
+           nil 'named nil range)
+    (nreverse found)))
+
+(ert-deftest tree-sitter-tests-walk-open-range ()
+  "START and END of `tree-sitter-walk' each work alone."
+  (tree-sitter-tests--with-c "int a;\nint b;\n"
+    (let ((root (tree-sitter-tree-root-node tree)))
+      (should (equal (tree-sitter-tests--walk-identifiers root 8) '(12)))
+      (should (equal (tree-sitter-tests--walk-identifiers root nil 7) '(5)))
+      (should (equal (tree-sitter-tests--walk-identifiers root) '(5 12)))
+      (should-error (tree-sitter-walk root #'ignore nil nil nil 0)
+                    :type 'args-out-of-range))))
+
+(provide 'tree-sitter-tests)
+;;; tree-sitter-tests.el ends here